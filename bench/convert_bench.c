@@ -0,0 +1,146 @@
+/*
+Host-side microbenchmark of the integer to string conversions in convert.c,
+against the itoa()/itoh() implementation which they replaced. This isn't part
+of the kernel image. Build and run it on an x86 host with:
+
+    make convert_bench && ./convert_bench
+
+It checks that both implementations agree before timing them, and prints the
+average number of TSC cycles per conversion.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "convert.h"
+#include "dmath.h"
+
+// Number of values converted, and number of passes over them.
+#define NVALUES 4096
+#define NPASSES 256
+
+static int32_t values[NVALUES];
+
+/*
+The original _itoa() from util.c, with the prefix written for hex and the
+return value as it was.
+*/
+static uint32_t old_itoa(int32_t x, uint8_t base, char *buf, uint16_t bufsize) {
+    uint32_t ndigit = 1u + ilog(base, abs(x));
+    const char *pfx = base == 16 ? "0x" : "";
+    uint32_t pfx_len = base == 16 ? 2 : 0;
+
+    uint32_t out_size = ndigit + pfx_len;
+    if (x < 0) {
+        out_size++;
+    }
+    if (bufsize <= out_size) {
+        return out_size;
+    }
+
+    uint32_t offset = 0;
+    if (x < 0) {
+        buf[0] = '-';
+        offset++;
+        x = -x;
+    }
+    for (uint8_t i = 0; i < pfx_len; i++) {
+        buf[offset++] = pfx[i];
+    }
+
+    uint32_t magnitude = ipow(base, ndigit - 1);
+    for (; offset < out_size; offset++) {
+        int32_t digit = x / magnitude;
+        buf[offset] = (char)(digit + (digit < 10 ? '0' : ('a' - 10)));
+        x = x % magnitude;
+        magnitude /= base;
+    }
+    buf[out_size] = (char)0;
+    return 0;
+}
+
+/*
+Fill the values with a spread of magnitudes, from 1 digit to 10, and signs.
+INT32_MIN is left out, since the old implementation can't convert it.
+*/
+static void fill_values() {
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < NVALUES; i++) {
+        seed = seed * 1103515245 + 12345;
+        int32_t x = (int32_t)((seed >> 1) >> (seed % 31));
+        values[i] = (seed & 0x80000000) ? -x : x;
+    }
+}
+
+/*
+Check that both implementations give the same string for every value. Return
+the number of mismatches.
+*/
+static uint32_t check(uint8_t base) {
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < NVALUES; i++) {
+        char old_buf[CONVERT_BUFSIZE];
+        char new_buf[CONVERT_BUFSIZE];
+        old_itoa(values[i], base, old_buf, CONVERT_BUFSIZE);
+
+        // The old hex conversion printed a prefix after the sign.
+        char *digits = new_buf;
+        if (base == 16) {
+            int32_t x = values[i];
+            uint32_t n = 0;
+            if (x < 0) {
+                new_buf[n++] = '-';
+            }
+            new_buf[n++] = '0';
+            new_buf[n++] = 'x';
+            digits = new_buf + n;
+            u32_to_str(x < 0 ? -(uint32_t)x : (uint32_t)x, 16, digits, CONVERT_BUFSIZE - n);
+        } else {
+            i32_to_str(values[i], base, new_buf, CONVERT_BUFSIZE);
+        }
+
+        if (strcmp(old_buf, new_buf)) {
+            printf("mismatch: %d in base %u: old \"%s\", new \"%s\"\n", values[i], base, old_buf, new_buf);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+/*
+Return the average number of cycles per conversion of every value, with either
+implementation.
+*/
+static double time_conversions(uint8_t base, int use_new) {
+    char buf[CONVERT_BUFSIZE];
+    uint32_t sink = 0;
+    uint64_t start = __rdtsc();
+    for (uint32_t pass = 0; pass < NPASSES; pass++) {
+        for (uint32_t i = 0; i < NVALUES; i++) {
+            if (use_new) {
+                i32_to_str(values[i], base, buf, CONVERT_BUFSIZE);
+            } else {
+                old_itoa(values[i], base, buf, CONVERT_BUFSIZE);
+            }
+            sink += (uint8_t)buf[1];
+        }
+    }
+    uint64_t cycles = __rdtsc() - start;
+
+    // Stop the compiler from discarding the conversions.
+    __asm__ volatile("" : : "r" (sink));
+    return (double)cycles / ((double)NPASSES * NVALUES);
+}
+
+int main() {
+    fill_values();
+    if (check(10) + check(16)) {
+        return 1;
+    }
+
+    printf("cycles per conversion   old     new\n");
+    printf("decimal              %6.1f  %6.1f\n", time_conversions(10, 0), time_conversions(10, 1));
+    printf("hex                  %6.1f  %6.1f\n", time_conversions(16, 0), time_conversions(16, 1));
+    return 0;
+}
@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -7,6 +8,7 @@
 #include "vga.h"
 #include "util.h"
 #include "low_level.h"
+#include "memmap.h"
 
 typedef struct {
     acpi_sdt_header_t header;
@@ -76,17 +78,57 @@ typedef struct {
     address_t x_gpe1_block;
 } __attribute__((packed)) fadt_t;
 
+// Set in the FADT flags if the PM timer is 32 bits wide, rather than 24.
+#define FADT_FLAG_TMR_VAL_EXT (1 << 8)
+
+// Address space of a generic address structure which is an I/O port.
+#define ADDRESS_SPACE_SYSTEM_IO 1
+
 const char FADT_SIGNATURE[SDT_HEADER_LEN] = "FACP";
 
 static fadt_t *fadt = 0x00;
 
+/*
+Get the address of a table pointed to by the FADT. The 64-bit address takes
+precedence in FADT >= 2.0, if the table is long enough to contain it.
+
+@param address: The 32-bit address.
+@param x_offset: Offset of the 64-bit address in the FADT.
+*/
+static uintptr_t get_table_address(uint32_t address, size_t x_offset) {
+    if (fadt->header.revision >= 2 && fadt->header.length >= x_offset + sizeof(uint64_t)) {
+        uint64_t x_address = *(uint64_t *)((uint8_t *)fadt + x_offset);
+        if (x_address) {
+            return (uintptr_t)x_address;
+        }
+    }
+    return address;
+}
+
+/*
+Reserve a table pointed to by the FADT. The FACS isn't an SDT, but also starts
+with its signature and length.
+*/
+static void reserve_table(uintptr_t address) {
+    if (address) {
+        const acpi_sdt_header_t *header = (const acpi_sdt_header_t *)address;
+        memmap_reserve(address, header->length, MEMMAP_ACPI);
+    }
+}
+
 void fadt_init() {
     fadt = (fadt_t *)get_sdt(FADT_SIGNATURE);
 
     // TODO: better error handling.
     if (!fadt) {
         println("Failed to locate FADT");
+        return;
     }
+
+    // The DSDT and FACS aren't in the RSDT, so they're only found through the
+    // FADT.
+    reserve_table(get_table_address(fadt->dsdt, offsetof(fadt_t, x_dsdt)));
+    reserve_table(get_table_address(fadt->firmware_ctrl, offsetof(fadt_t, x_firmware_control)));
 }
 
 void acpi_enable() {
@@ -94,6 +136,31 @@ void acpi_enable() {
     while ( (read_word(fadt->pm1a_control_block) & 1) == 0);
 }
 
+uint16_t fadt_get_pm_timer(bool *is_32bit) {
+    if (!fadt) {
+        return 0;
+    }
+
+    *is_32bit = fadt->flags & FADT_FLAG_TMR_VAL_EXT;
+
+    // The extended address takes precedence in FADT >= 2.0, if the table is
+    // long enough to contain it.
+    if (fadt->header.revision >= 2 &&
+            fadt->header.length >= offsetof(fadt_t, x_pm_timer_block) + sizeof(address_t) &&
+            fadt->x_pm_timer_block.address) {
+        // Memory-mapped PM timers are not supported.
+        if (fadt->x_pm_timer_block.address_space != ADDRESS_SPACE_SYSTEM_IO) {
+            return 0;
+        }
+        return (uint16_t)fadt->x_pm_timer_block.address;
+    }
+
+    if (fadt->pm_timer_length != 4) {
+        return 0;
+    }
+    return fadt->pm_timer_block;
+}
+
 bool ps2_controller_exists() {
     if (!fadt) {
         // System doesn't support ACPI.
@@ -16,6 +16,14 @@ Switch to ACPI mode.
 */
 void acpi_enable();
 
+/*
+Get the I/O port of the ACPI power management timer, or 0 if there is none.
+
+@param is_32bit: Receives true if the timer is 32 bits wide, or false if it's
+24 bits wide.
+*/
+uint16_t fadt_get_pm_timer(bool *is_32bit);
+
 /*
 Check whether a PS2 controller exists.
 */
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hpet.h"
+#include "rsdt.h"
+
+#include "clock.h"
+#include "dmath.h"
+#include "vga.h"
+
+// Address space of a generic address structure which is memory-mapped.
+#define ADDRESS_SPACE_SYSTEM_MEMORY 0
+
+// HPET registers (byte offsets from the base address).
+#define HPET_CAPABILITIES 0x000
+#define HPET_CONFIG 0x010
+#define HPET_COUNTER 0x0f0
+
+// Capabilities register, low dword: the main counter is 64 bits wide.
+#define CAP_COUNT_SIZE_64 (1 << 13)
+
+// The high dword of the capabilities register holds the period of the main
+// counter, in femtoseconds. The spec limits the period to 100 ns.
+#define MAX_PERIOD_FS 100000000
+
+#define FEMTOSECONDS_PER_SECOND 1000000000000000ull
+
+// Configuration register: start the main counter.
+#define CONFIG_ENABLE 0x01
+
+// The HPET is cheap to read and doesn't depend on the CPU's power state.
+#define RATING_HPET 250
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t event_timer_block_id;
+    address_t base_address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) hpet_table_t;
+
+const char HPET_SIGNATURE[SDT_HEADER_LEN] = "HPET";
+
+static volatile uint32_t *hpet = 0;
+
+static uint32_t hpet_read(uint32_t reg) {
+    return hpet[reg / 4];
+}
+
+static void hpet_write(uint32_t reg, uint32_t value) {
+    hpet[reg / 4] = value;
+}
+
+static uint64_t read_counter32() {
+    return hpet_read(HPET_COUNTER);
+}
+
+/*
+Read the 64-bit main counter with two 32-bit reads. If the low half wraps
+between the reads, the high half changes, so retry until it reads the same
+before and after.
+*/
+static uint64_t read_counter64() {
+    uint32_t high, low;
+    do {
+        high = hpet_read(HPET_COUNTER + 4);
+        low = hpet_read(HPET_COUNTER);
+    } while (high != hpet_read(HPET_COUNTER + 4));
+    return ((uint64_t)high << 32) | low;
+}
+
+static clocksource_t hpet_clocksource = {
+    .name = "hpet",
+    .read = read_counter32,
+    .mask = 0xffffffff,
+    .freq_hz = 0,
+    .rating = RATING_HPET
+};
+
+void hpet_init() {
+    hpet_table_t *table = (hpet_table_t *)get_sdt(HPET_SIGNATURE);
+    if (!table) {
+        return;
+    }
+
+    // Addresses above 4 GiB are unreachable without PAE.
+    if (table->base_address.address_space != ADDRESS_SPACE_SYSTEM_MEMORY ||
+            table->base_address.address >> 32) {
+        return;
+    }
+    hpet = (volatile uint32_t *)(uintptr_t)table->base_address.address;
+
+    uint32_t period = hpet_read(HPET_CAPABILITIES + 4);
+    if (period == 0 || period > MAX_PERIOD_FS) {
+        println("HPET: invalid period %u fs", period);
+        return;
+    }
+
+    uint64_t freq = FEMTOSECONDS_PER_SECOND;
+    div64_32(&freq, period);
+    hpet_clocksource.freq_hz = (uint32_t)freq;
+
+    if (hpet_read(HPET_CAPABILITIES) & CAP_COUNT_SIZE_64) {
+        hpet_clocksource.read = read_counter64;
+        hpet_clocksource.mask = ~0ull;
+    }
+
+    // Start the main counter. Legacy replacement routing is left off, so the
+    // PIT keeps driving IRQ0.
+    hpet_write(HPET_CONFIG, hpet_read(HPET_CONFIG) | CONFIG_ENABLE);
+
+    clock_register(&hpet_clocksource);
+
+    uint32_t khz = hpet_clocksource.freq_hz / 1000;
+    println("HPET: %u.%03u MHz, %u-bit counter", khz / 1000, khz % 1000,
+            hpet_clocksource.mask == ~0ull ? 64 : 32);
+}
@@ -0,0 +1,13 @@
+#ifndef _DREWOS_HPET_H_
+#define _DREWOS_HPET_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Locate the HPET table, enable the HPET's main counter, and register it as a
+clocksource. This must be called after acpi_init() and clock_init().
+*/
+void hpet_init();
+
+#endif // _DREWOS_HPET_H_
@@ -6,13 +6,25 @@
 
 #include "vga.h"
 
+// MADT entry types.
+#define MADT_ENTRY_LAPIC 0
+#define MADT_ENTRY_IOAPIC 1
+#define MADT_ENTRY_OVERRIDE 2
+#define MADT_ENTRY_LAPIC_ADDRESS 5
+
+// Set in madt_t.flags if the system has dual 8259 PICs.
+#define MADT_FLAG_PCAT_COMPAT 0x01
+
+// Set in a local APIC entry's flags if the processor is usable.
+#define LAPIC_FLAG_ENABLED 0x01
+
 typedef struct {
     uint8_t entry_type;
     uint8_t length;
 } __attribute__((packed)) madt_entry_header_t;
 
 typedef struct {
-    acpi_sdt_header_t *header;
+    acpi_sdt_header_t header;
 
     // Local APIC address.
     uint32_t apic_address;
@@ -21,15 +33,131 @@ typedef struct {
     uint32_t flags;
 } __attribute__((packed)) madt_t;
 
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_entry_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_entry_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_override_entry_t;
+
+// Overrides the 32-bit local APIC address in the MADT header.
+typedef struct {
+    madt_entry_header_t header;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) madt_lapic_address_entry_t;
+
 const char MADT_SIGNATURE[SDT_HEADER_LEN] = "APIC";
 
 static madt_t *madt = 0x00;
 
+static madt_info_t info;
+
+static void parse_entry(const madt_entry_header_t *entry) {
+    switch (entry->entry_type) {
+        case MADT_ENTRY_LAPIC: {
+            const madt_lapic_entry_t *e = (const madt_lapic_entry_t *)entry;
+            if (info.nlapic < MADT_MAX_LAPICS) {
+                madt_lapic_t *lapic = &info.lapics[info.nlapic++];
+                lapic->processor_id = e->processor_id;
+                lapic->apic_id = e->apic_id;
+                lapic->enabled = e->flags & LAPIC_FLAG_ENABLED;
+            }
+            break;
+        }
+        case MADT_ENTRY_IOAPIC: {
+            const madt_ioapic_entry_t *e = (const madt_ioapic_entry_t *)entry;
+            if (info.nioapic < MADT_MAX_IOAPICS) {
+                madt_ioapic_t *ioapic = &info.ioapics[info.nioapic++];
+                ioapic->id = e->id;
+                ioapic->address = e->address;
+                ioapic->gsi_base = e->gsi_base;
+            }
+            break;
+        }
+        case MADT_ENTRY_OVERRIDE: {
+            const madt_override_entry_t *e = (const madt_override_entry_t *)entry;
+            if (info.noverride < MADT_MAX_OVERRIDES) {
+                madt_override_t *override = &info.overrides[info.noverride++];
+                override->irq = e->source;
+                override->gsi = e->gsi;
+                override->flags = e->flags;
+            }
+            break;
+        }
+        case MADT_ENTRY_LAPIC_ADDRESS: {
+            const madt_lapic_address_entry_t *e = (const madt_lapic_address_entry_t *)entry;
+            // Addresses above 4 GiB are unreachable without PAE.
+            if (e->address >> 32 == 0) {
+                info.lapic_address = (uint32_t)e->address;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 void madt_init() {
     madt = (madt_t *)get_sdt(MADT_SIGNATURE);
 
     // TODO: better error handling.
     if (!madt) {
         println("Failed to locate MADT");
+        return;
     }
+
+    info.lapic_address = madt->apic_address;
+    info.has_8259 = madt->flags & MADT_FLAG_PCAT_COMPAT;
+    info.nlapic = info.nioapic = info.noverride = 0;
+
+    // The entries follow the fixed part of the table. Stop at a zero-length
+    // entry rather than looping forever on a corrupt table.
+    const uint8_t *ptr = (const uint8_t *)madt + sizeof(madt_t);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+    while (ptr + sizeof(madt_entry_header_t) <= end) {
+        const madt_entry_header_t *entry = (const madt_entry_header_t *)ptr;
+        if (entry->length < sizeof(madt_entry_header_t) || ptr + entry->length > end) {
+            break;
+        }
+        parse_entry(entry);
+        ptr += entry->length;
+    }
+
+    println("MADT: %u local APIC(s), %u I/O APIC(s), %u interrupt source override(s)", info.nlapic, info.nioapic, info.noverride);
+}
+
+const madt_info_t *madt_get_info() {
+    return madt ? &info : 0;
+}
+
+uint32_t madt_irq_to_gsi(uint8_t irq, uint16_t *flags) {
+    if (madt) {
+        for (uint8_t i = 0; i < info.noverride; i++) {
+            if (info.overrides[i].irq == irq) {
+                *flags = info.overrides[i].flags;
+                return info.overrides[i].gsi;
+            }
+        }
+    }
+
+    // ISA IRQs are identity-mapped unless overridden.
+    *flags = 0;
+    return irq;
 }
@@ -6,6 +6,80 @@
 
 #include "rsdt.h"
 
+// Maximum number of each type of entry which will be recorded. Any more are
+// ignored.
+#define MADT_MAX_LAPICS 16
+#define MADT_MAX_IOAPICS 4
+#define MADT_MAX_OVERRIDES 16
+
+// Polarity and trigger mode flags of an interrupt source override.
+#define MADT_POLARITY_MASK 0x03
+#define MADT_POLARITY_ACTIVE_LOW 0x03
+#define MADT_TRIGGER_MASK 0x0c
+#define MADT_TRIGGER_LEVEL 0x0c
+
+// A processor's local APIC.
+typedef struct {
+    uint8_t processor_id;
+    uint8_t apic_id;
+    bool enabled;
+} madt_lapic_t;
+
+// An I/O APIC.
+typedef struct {
+    uint8_t id;
+
+    // Physical address of the I/O APIC's registers.
+    uint32_t address;
+
+    // Global system interrupt number of the I/O APIC's first input.
+    uint32_t gsi_base;
+} madt_ioapic_t;
+
+// An ISA IRQ which is not connected to the I/O APIC input of the same number.
+typedef struct {
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} madt_override_t;
+
+// Interrupt controllers described by the MADT.
+typedef struct {
+    // Physical address of the local APICs' registers.
+    uint32_t lapic_address;
+
+    // True if the system also has dual 8259 PICs.
+    bool has_8259;
+
+    uint8_t nlapic;
+    madt_lapic_t lapics[MADT_MAX_LAPICS];
+
+    uint8_t nioapic;
+    madt_ioapic_t ioapics[MADT_MAX_IOAPICS];
+
+    uint8_t noverride;
+    madt_override_t overrides[MADT_MAX_OVERRIDES];
+} madt_info_t;
+
+/*
+Locate the MADT, and record the interrupt controllers it describes.
+*/
 void madt_init();
 
+/*
+Get the interrupt controllers described by the MADT, or NULL if there is no
+MADT.
+*/
+const madt_info_t *madt_get_info();
+
+/*
+Get the global system interrupt to which an ISA IRQ is connected, taking
+interrupt source overrides into account.
+
+@param irq: The ISA IRQ.
+@param flags: Receives the override's polarity and trigger mode flags, or 0 if
+the IRQ has the ISA defaults (active high, edge triggered).
+*/
+uint32_t madt_irq_to_gsi(uint8_t irq, uint16_t *flags);
+
 #endif // _DREWOS_MADT_H_
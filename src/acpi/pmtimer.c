@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pmtimer.h"
+#include "fadt.h"
+
+#include "clock.h"
+#include "low_level.h"
+#include "vga.h"
+
+// The PM timer always runs at this frequency.
+#define PM_TIMER_FREQ 3579545
+
+// The PM timer is slower to read than the HPET, but more widely available.
+#define RATING_PM_TIMER 200
+
+static uint16_t port = 0;
+
+static uint64_t read_pm_timer() {
+    return read_dword(port);
+}
+
+// The mask is set to 24 or 32 bits by pmtimer_init(). Either way, the counter
+// wraps around within seconds, which the clock code handles by reading it at
+// least once a second.
+static clocksource_t pm_clocksource = {
+    .name = "acpi_pm",
+    .read = read_pm_timer,
+    .mask = 0xffffff,
+    .freq_hz = PM_TIMER_FREQ,
+    .rating = RATING_PM_TIMER
+};
+
+void pmtimer_init() {
+    bool is_32bit = false;
+    port = fadt_get_pm_timer(&is_32bit);
+    if (!port) {
+        return;
+    }
+
+    pm_clocksource.mask = is_32bit ? 0xffffffff : 0xffffff;
+    clock_register(&pm_clocksource);
+    println("ACPI PM timer at port %#x, %u bits", port, is_32bit ? 32 : 24);
+}
@@ -0,0 +1,10 @@
+#ifndef _DREWOS_PMTIMER_H_
+#define _DREWOS_PMTIMER_H_
+
+/*
+Register the ACPI power management timer as a clocksource, if the FADT
+describes one. This must be called after acpi_init() and clock_init().
+*/
+void pmtimer_init();
+
+#endif // _DREWOS_PMTIMER_H_
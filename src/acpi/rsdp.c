@@ -3,6 +3,7 @@
 
 #include "vga.h"
 #include "util.h"
+#include "memmap.h"
 
 #include "rsdp.h"
 #include "rsdt.h"
@@ -152,5 +153,8 @@ void init_rsdp() {
         rsdt = (rsdt_t *)rsdp->rsdt_address;
     }
 
+    uint32_t length = xsdp ? xsdp->length : sizeof(rsdp_t);
+    memmap_reserve((uintptr_t)sdp, length, MEMMAP_ACPI);
+
     rsdt_init(rsdt, xsdt);
 }
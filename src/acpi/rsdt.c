@@ -7,6 +7,7 @@
 #include "madt.h"
 
 #include "vga.h"
+#include "memmap.h"
 
 // Pointer to the RSDT/XSDT. Only one of these will be non-null.
 static rsdt_t *rsdt = 0x00;
@@ -23,36 +24,72 @@ bool validate_checksum(const acpi_sdt_header_t *header) {
     return checksum == 0;
 }
 
+// Maximum number of tables recorded. Any more are ignored.
+#define MAX_TABLES 64
+
+// Number of slots in the table of signatures. Must be a power of 2, and larger
+// than MAX_TABLES, so that there's always an empty slot.
+#define SIGNATURE_SLOTS 128
+
+// Marks the end of a list of tables.
+#define NO_TABLE 0xff
+
+// The valid tables, in the order they appear in the RSDT/XSDT, and the index of
+// the next table with the same signature.
+static acpi_sdt_header_t *tables[MAX_TABLES];
+static uint8_t next_instance[MAX_TABLES];
+static uint32_t num_tables = 0;
+
+// A distinct signature, and the first and last of the tables which have it.
+// Slots are found by hashing the signature, and probing linearly from there.
+typedef struct {
+    uint32_t signature;
+    uint8_t first;
+    uint8_t last;
+    uint8_t count;
+} signature_slot_t;
+
+static signature_slot_t slots[SIGNATURE_SLOTS];
+
 /*
-Return true iff the SDT header contains a signature matching the expected signature.
+Get a signature as a single integer, so that it can be compared and hashed in
+one go.
 */
-bool validate_signature(const acpi_sdt_header_t *header, const char signature[SDT_HEADER_LEN]) {
-    for (int i = 0; i < SDT_HEADER_LEN; i++) {
-        if (header->signature[i] != signature[i]) {
-            return false;
-        }
+static uint32_t signature_key(const char signature[SDT_HEADER_LEN]) {
+    const uint8_t *s = (const uint8_t *)signature;
+    return s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t)s[3] << 24);
+}
+
+/*
+Find the slot for a signature: either the slot which holds it, or the empty
+slot where it would go.
+*/
+static signature_slot_t *find_slot(uint32_t key) {
+    uint32_t i = (key * 2654435761u) >> 25;
+    while (slots[i].count && slots[i].signature != key) {
+        i = (i + 1) & (SIGNATURE_SLOTS - 1);
     }
-    return true;
+    return &slots[i];
 }
 
 /*
 Get the number of tables in the RSDT (or XSDT if using ACPI >= v2).
 */
 static uint32_t get_num_tables() {
-    // TODO: is sizeof(uintptr_t) correct here? Unsure if we can rely on its
-    // width.
     if (rsdt) {
-        return (rsdt->header.length - sizeof(acpi_sdt_header_t)) / sizeof(uintptr_t);
+        return (rsdt->header.length - sizeof(acpi_sdt_header_t)) / sizeof(uint32_t);
     }
     if (xsdt) {
-        return (xsdt->header.length - sizeof(acpi_sdt_header_t)) / sizeof(uintptr_t);
+        // The XSDT holds 64-bit addresses, even on a 32-bit machine.
+        return (xsdt->header.length - sizeof(acpi_sdt_header_t)) / sizeof(uint64_t);
     }
 
     return 0;
 }
 
 /*
-Get the i-th table in the RSDT (or XSDT if using ACPI >= v2).
+Get the i-th table in the RSDT (or XSDT if using ACPI >= v2). Return NULL if
+the table isn't addressable.
 */
 static acpi_sdt_header_t *get_table(uint32_t i) {
     if (rsdt) {
@@ -62,9 +99,12 @@ static acpi_sdt_header_t *get_table(uint32_t i) {
     }
 
     if (xsdt) {
-        // Note this will need to be revised if we move to 64-bit. Not sure if
-        // uintptr_t is correct here.
+        // Note this will need to be revised if we move to 64-bit. Tables above
+        // 4 GiB are unreachable without PAE.
         uint64_t *tables = (uint64_t *)((char *)xsdt + sizeof(acpi_sdt_header_t));
+        if (tables[i] >> 32) {
+            return 0;
+        }
         acpi_sdt_header_t *header = (acpi_sdt_header_t *)(uintptr_t)tables[i];
         return header;
     }
@@ -72,23 +112,88 @@ static acpi_sdt_header_t *get_table(uint32_t i) {
     return 0;
 }
 
-acpi_sdt_header_t *get_sdt(const char signature[SDT_HEADER_LEN]) {
-    uint32_t n = get_num_tables();
+/*
+Record a table with a valid checksum.
+*/
+static void add_table(acpi_sdt_header_t *header) {
+    if (num_tables >= MAX_TABLES) {
+        println("Too many ACPI tables; ignoring %c%c%c%c", header->signature[0],
+                header->signature[1], header->signature[2], header->signature[3]);
+        return;
+    }
+
+    // Keep the table out of the way of the memory allocator.
+    memmap_reserve((uintptr_t)header, header->length, MEMMAP_ACPI);
+
+    uint8_t index = num_tables++;
+    tables[index] = header;
+    next_instance[index] = NO_TABLE;
 
+    uint32_t key = signature_key(header->signature);
+    signature_slot_t *slot = find_slot(key);
+    if (slot->count) {
+        next_instance[slot->last] = index;
+    } else {
+        slot->signature = key;
+        slot->first = index;
+    }
+    slot->last = index;
+    slot->count++;
+}
+
+/*
+Validate every table in the RSDT/XSDT, and record the valid ones. Each table is
+checksummed exactly once.
+*/
+static void build_registry() {
+    uint32_t n = get_num_tables();
     for (uint32_t i = 0; i < n; i++) {
         acpi_sdt_header_t *header = get_table(i);
+        if (!header || header->length < sizeof(acpi_sdt_header_t)) {
+            continue;
+        }
 
-        if (validate_checksum(header) && validate_signature(header, signature)) {
-            return header;
+        if (!validate_checksum(header)) {
+            println("Invalid %c%c%c%c checksum", header->signature[0],
+                    header->signature[1], header->signature[2], header->signature[3]);
+            continue;
         }
+        add_table(header);
     }
-    return 0;
+}
+
+acpi_sdt_header_t *get_sdt(const char signature[SDT_HEADER_LEN]) {
+    signature_slot_t *slot = find_slot(signature_key(signature));
+    return slot->count ? tables[slot->first] : 0;
+}
+
+uint32_t get_sdt_count(const char signature[SDT_HEADER_LEN]) {
+    return find_slot(signature_key(signature))->count;
+}
+
+acpi_sdt_header_t *get_sdt_instance(const char signature[SDT_HEADER_LEN], uint32_t n) {
+    signature_slot_t *slot = find_slot(signature_key(signature));
+    if (n >= slot->count) {
+        return 0;
+    }
+
+    uint8_t index = slot->first;
+    while (n--) {
+        index = next_instance[index];
+    }
+    return tables[index];
 }
 
 void rsdt_init(rsdt_t *r, xsdt_t *x) {
     rsdt = r;
     xsdt = x;
 
+    // Start with no tables, so lookups fail cleanly if the RSDT is invalid.
+    num_tables = 0;
+    for (uint32_t i = 0; i < SIGNATURE_SLOTS; i++) {
+        slots[i].count = 0;
+    }
+
     // TODO: better error handling.
 
     if (rsdt && !validate_checksum(&rsdt->header)) {
@@ -101,6 +206,13 @@ void rsdt_init(rsdt_t *r, xsdt_t *x) {
         return;
     }
 
+    if (rsdt || xsdt) {
+        acpi_sdt_header_t *root = xsdt ? &xsdt->header : &rsdt->header;
+        memmap_reserve((uintptr_t)root, root->length, MEMMAP_ACPI);
+    }
+
+    build_registry();
+
     fadt_init();
     madt_init();
 }
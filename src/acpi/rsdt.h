@@ -42,11 +42,32 @@ Return true iff the SDT header has a valid checksum.
 bool validate_checksum(const acpi_sdt_header_t *header);
 
 /*
-Get the SDT with the specified signature, if one exists with a valid signature
-and checksum. If none is found, NULL will be returned.
+Get the first SDT with the specified signature, if one exists with a valid
+checksum. If none is found, NULL will be returned.
 */
 acpi_sdt_header_t *get_sdt(const char signature[SDT_HEADER_LEN]);
 
+/*
+Get the number of SDTs with the specified signature and a valid checksum, eg
+the number of SSDTs.
+*/
+uint32_t get_sdt_count(const char signature[SDT_HEADER_LEN]);
+
+/*
+Get the n-th SDT with the specified signature and a valid checksum, in the
+order they appear in the RSDT/XSDT. If there are no more than n, NULL will be
+returned.
+
+@param signature: The signature.
+@param n: Index of the table, starting from 0.
+*/
+acpi_sdt_header_t *get_sdt_instance(const char signature[SDT_HEADER_LEN], uint32_t n);
+
+/*
+Validate every table in the RSDT (or XSDT if using ACPI >= v2) and record the
+valid ones, so that they can be looked up by signature without walking or
+checksumming them again. Then initialise the tables which the kernel uses.
+*/
 void rsdt_init(rsdt_t *rsdt, xsdt_t *xsdt);
 
 #endif // _DREWOS_RSDT_H_
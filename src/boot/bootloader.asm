@@ -1,77 +1,57 @@
-; A boot sector that boots a C kernel in 32-bit protected mode.
+; A boot sector that loads the second stage of the bootloader, which loads the
+; C kernel above 1 MiB and boots it in 32-bit protected mode.
 [org 0x7c00]
 
-; This is the memory offset to which we will load our kernel.
-KERNEL_OFFSET equ 0x1000
+; This is the memory offset to which we will load the second stage. It
+; directly follows the boot sector, and must match the org in stage2.asm.
+STAGE2_OFFSET equ 0x7e00
+
+; Number of sectors of the second stage to load. The Makefile passes the size
+; of stage2.bin, which is padded to a whole sector.
+%ifndef STAGE2_SECTORS
+%error "STAGE2_SECTORS must be defined"
+%endif
+
+; The second stage must end below the buffer at 0x10000 which it reads the
+; kernel into.
+%if STAGE2_SECTORS > (0x10000 - STAGE2_OFFSET) / 512
+%error "The second stage is too large"
+%endif
+
+; Make sure the data segments match the org.
+xor ax, ax
+mov ds, ax
+mov es, ax
 
 ; BIOS stores our boot drive in dl.
 mov [BOOT_DRIVE], dl
 
-; Setup the stack.
-mov bp, 0x9000
+; Setup the stack, below the boot sector.
+mov bp, 0x7c00
+mov ss, ax
 mov sp, bp
 
-; Print welcome message.
+; Clear the screen. The second stage prints the first message.
 call clrscr
-mov bx, MSG_REAL_MODE
-call println
-
-; Load the kernel.
-call load_kernel
 
-; Switch to protected mode.
-call switch_to_pm
+; Load the second stage. It starts in the sector after the boot sector.
+mov ax, STAGE2_OFFSET >> 4
+mov es, ax
+mov ax, 1
+mov cx, STAGE2_SECTORS
+call disk_load
 
-jmp $
+; Restore es, and pass the boot drive on in dl.
+xor ax, ax
+mov es, ax
+mov dl, [BOOT_DRIVE]
+jmp 0:STAGE2_OFFSET
 
 ; Dependencies
 %include "util.asm"
-%include "gdt.asm"
-%include "protected_mode.asm"
-%include "util_pm.asm"
-
-[bits 16]
-
-load_kernel:
-    mov bx, MSG_LOAD_KERNEL
-    call println
-
-    mov bx, KERNEL_OFFSET
-
-    ; Number of sectors to read.
-    mov dh, 32
-
-    ; The disk to read from.
-    mov dl, [BOOT_DRIVE]
-
-    ; Read.
-    call disk_load
-
-    ; debug
-    ; ; Print out the first loaded word.
-    mov dx, [KERNEL_OFFSET]
-    call println_hex
-
-    ret
-
-[bits 32]
-; This is where we arrive after switching to and initialising protected mode.
-BEGIN_PM:
-    ; Print a message to verify successful entry into protected mode.
-    mov ebx, MSG_PROT_MODE
-    call print_pm
-
-    ; Now jump to the address of our loaded kernel code.
-    call KERNEL_OFFSET
-
-    ; Hang.
-    jmp $
 
 ; Global variables.
 BOOT_DRIVE db 0
-MSG_REAL_MODE db "Started", 0
-MSG_PROT_MODE db "Protected", 0
-MSG_LOAD_KERNEL db "Loading kernel", 0
 
 times 510-($-$$) db 0
 dw 0xaa55
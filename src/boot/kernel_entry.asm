@@ -1,12 +1,89 @@
-
-; Entrypoint to the kernel's main function.
+; Entrypoint to the kernel's main function. The kernel is entered either from
+; our own bootloader, or from a Multiboot loader such as GRUB or QEMU's -kernel
+; option, in 32-bit protected mode in both cases.
 [bits 32]
 
 ; main symbol will be resolved by the linker.
 [extern main]
 
-; Enter the main function.
-call main
+; Bounds of .bss, from linker.ld.
+[extern __bss_start]
+[extern __bss_end]
+
+; The Multiboot header asks for modules to be page aligned, and for the memory
+; map.
+MULTIBOOT_MAGIC equ 0x1badb002
+MULTIBOOT_FLAGS equ (1 << 0) | (1 << 1)
+
+; Size of the kernel's stack.
+STACK_SIZE equ 0x10000
+
+; The entrypoint has its own section, which linker.ld places at the start of
+; the image, where the bootloader jumps to.
+section .text.entry progbits alloc exec nowrite align=16
+
+global _start
+_start:
+    jmp start
+
+; The Multiboot header must be dword aligned, in the first 8 KiB of the image.
+align 4
+multiboot_header:
+    dd MULTIBOOT_MAGIC
+    dd MULTIBOOT_FLAGS
+    dd -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
+
+start:
+    ; A Multiboot loader passes its magic number in eax, and its information
+    ; in ebx. Our own bootloader passes its own magic number, and the memory
+    ; map in the same format. Keep them for main(), which checks the magic
+    ; number.
+    mov esi, eax
+    mov edx, ebx
+
+    ; Zero .bss, which isn't part of the loaded image. linker.ld aligns both
+    ; ends, so it's a whole number of dwords.
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    shr ecx, 2
+    xor eax, eax
+    cld
+    rep stosd
+
+    ; A Multiboot loader's GDT may be anywhere, and it doesn't set up a stack,
+    ; so load our own GDT and stack.
+    lgdt [gdt_descriptor]
+    jmp CODE_SEG:reload_segments
+
+reload_segments:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, stack_top
+
+    ; Enter the main function.
+    push edx
+    push esi
+    call main
+
+; Hang if the main function ever returns, without spinning the CPU.
+hang:
+    cli
+    hlt
+    jmp hang
+
+section .data
+
+; The same flat segments as the bootloader's.
+%include "gdt.asm"
+
+section .bss
 
-; Hang if the main function ever returns.
-jmp $
+align 16
+stack_bottom:
+    resb STACK_SIZE
+stack_top:
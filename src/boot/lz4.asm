@@ -0,0 +1,114 @@
+; LZ4 decompressor for the kernel image, which is compressed in the legacy frame
+; format written by `lz4 -l`: a magic number, followed by blocks, each preceded
+; by its compressed size.
+;
+; A block is a series of sequences. Each sequence starts with a token: the top
+; nibble is the number of literal bytes that follow, and the bottom nibble is
+; the length of a match, minus 4, which follows the literals as a 16-bit offset
+; back into the output. A nibble of 15 is extended by the following bytes,
+; until one is less than 255. The last sequence of a block has only literals.
+[bits 32]
+
+LZ4_LEGACY_MAGIC equ 0x184c2102
+
+; Decompress an LZ4 legacy frame. Hang if it doesn't start with the magic
+; number.
+; Inputs:
+; esi: The frame.
+; ecx: Size of the frame.
+; edi: Where to decompress it to.
+lz4_decompress:
+    pusha
+    cld
+
+    ; Keep the end of the frame on the stack.
+    add ecx, esi
+    push ecx
+
+    lodsd
+    cmp eax, LZ4_LEGACY_MAGIC
+    jne lz4_error
+
+    lz4_decompress_next:
+        cmp esi, [esp]
+        jae lz4_decompress_done
+
+        ; Frames may be concatenated, so the magic number may appear again
+        ; in place of a block size.
+        lodsd
+        cmp eax, LZ4_LEGACY_MAGIC
+        je lz4_decompress_next
+
+        lea ebx, [esi + eax]
+        call lz4_decompress_block
+        jmp lz4_decompress_next
+
+    lz4_decompress_done:
+        pop ecx
+        popa
+        ret
+
+lz4_error:
+    jmp $
+
+; Decompress an LZ4 block.
+; Inputs:
+; esi: The block. Receives the end of the block.
+; ebx: The end of the block.
+; edi: Where to decompress it to. Receives the end of the output.
+lz4_decompress_block:
+    ; Read the token, leaving the top 24 bits of eax clear, so that the
+    ; length bytes read by lodsb can be added to ecx directly.
+    xor eax, eax
+    lodsb
+    mov edx, eax
+
+    ; Copy the literals.
+    mov ecx, eax
+    shr ecx, 4
+    cmp ecx, 15
+    jne lz4_block_literals
+
+    lz4_block_literal_length:
+        lodsb
+        add ecx, eax
+        cmp al, 255
+        je lz4_block_literal_length
+
+    lz4_block_literals:
+        rep movsb
+
+        cmp esi, ebx
+        jae lz4_block_done
+
+    ; Read the offset of the match.
+    xor eax, eax
+    lodsw
+    mov ebp, eax
+
+    mov ecx, edx
+    and ecx, 15
+    cmp ecx, 15
+    jne lz4_block_match
+
+    xor eax, eax
+    lz4_block_match_length:
+        lodsb
+        add ecx, eax
+        cmp al, 255
+        je lz4_block_match_length
+
+    ; Copy the match from earlier in the output. It may overlap the bytes
+    ; being written, which repeats them, so it must be copied a byte at a
+    ; time, in order.
+    lz4_block_match:
+        add ecx, 4
+        push esi
+        mov esi, edi
+        sub esi, ebp
+        rep movsb
+        pop esi
+        jmp lz4_decompress_block
+
+    lz4_block_done:
+        ret
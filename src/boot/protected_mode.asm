@@ -29,8 +29,9 @@ init_pm:
     mov fs, ax
     mov gs, ax
 
-    ; Update our stack position so it is right at the top of the free space.
-    mov ebp, 0x90000
+    ; Keep the stack where the boot sector put it, below 0x7c00, which is free
+    ; on every machine. The kernel sets up its own.
+    mov ebp, 0x7c00
     mov esp, ebp
 
     ; Finally, call some well-known label.
@@ -0,0 +1,287 @@
+; The second stage of the bootloader. It loads the C kernel at 1 MiB, and boots
+; it in 32-bit protected mode.
+;
+; Real mode can only address the first 1 MiB, so the kernel is read into a
+; buffer below 1 MiB a chunk at a time, and each chunk is copied above 1 MiB
+; in unreal mode: real mode with 4 GiB segment limits, left over from a brief
+; switch to protected mode.
+;
+; The kernel is compressed with LZ4 on disk, since decompressing it is much
+; faster than reading the rest of it from disk. It is loaded above where the
+; kernel will be, and decompressed into place once in protected mode.
+[org 0x7e00]
+[bits 16]
+
+; This is the address at which the kernel is linked. It must match linker.ld.
+KERNEL_OFFSET equ 0x100000
+
+; Size in bytes of the kernel, and of the compressed kernel on disk. The
+; Makefile passes both, and pads the image to a whole sector.
+%ifndef KERNEL_SIZE
+%error "KERNEL_SIZE must be defined"
+%endif
+%ifndef COMPRESSED_SIZE
+%error "COMPRESSED_SIZE must be defined"
+%endif
+
+; Number of sectors of compressed kernel to load.
+COMPRESSED_SECTORS equ (COMPRESSED_SIZE + 511) / 512
+
+; Sectors are counted in 16 bits, which allows a kernel of up to 16 MiB.
+%if COMPRESSED_SECTORS > 0x8000
+%error "The kernel is too large to load"
+%endif
+
+; The compressed kernel is loaded at the first page after the end of the
+; decompressed kernel, so that decompressing it doesn't overwrite it.
+COMPRESSED_OFFSET equ KERNEL_OFFSET + ((KERNEL_SIZE + 0xfff) & ~0xfff)
+
+; The kernel follows the boot sector and this stage.
+KERNEL_LBA equ 1 + STAGE2_SECTORS
+
+; The buffer which the kernel is read into, and its size in sectors. This is
+; the most that can be read with a single BIOS call.
+BUFFER_OFFSET equ 0x10000
+BUFFER_SECTORS equ 127
+
+; The information passed to the kernel, in the format of a Multiboot
+; information structure, but with only the memory map. This is in free memory
+; below the stack, which the kernel copies before using.
+BOOT_INFO_OFFSET equ 0x500
+BOOT_INFO_FLAGS equ 0
+BOOT_INFO_MMAP_LENGTH equ 44
+BOOT_INFO_MMAP_ADDR equ 48
+BOOT_INFO_MEM_MAP equ 1 << 6
+
+; Passed to the kernel in eax, with the address of the information in ebx. It
+; must match multiboot.h.
+BOOT_MAGIC equ 0x44524557
+
+; The memory map follows the information. Each entry is an E820 entry, preceded
+; by its size, as in a Multiboot memory map.
+MMAP_OFFSET equ 0x600
+MMAP_ENTRY_SIZE equ 24
+MMAP_MAX_ENTRIES equ 32
+
+; "SMAP", which E820 calls are signed with.
+E820_SIGNATURE equ 0x534d4150
+
+stage2:
+    ; The boot sector passes the boot drive in dl.
+    mov [BOOT_DRIVE], dl
+
+    mov bx, MSG_LOAD_KERNEL
+    call println
+
+    call enable_a20
+    call load_kernel
+    call read_memory_map
+
+    ; Switch to protected mode.
+    call switch_to_pm
+
+    jmp $
+
+; Dependencies
+%include "util.asm"
+%include "gdt.asm"
+%include "protected_mode.asm"
+
+[bits 16]
+
+; Set ZF if the A20 line is disabled, ie if 0xffff:0x7e0e wraps around to the
+; boot signature at 0x0000:0x7dfe.
+check_a20:
+    push ds
+    push es
+
+    xor ax, ax
+    mov ds, ax
+    not ax
+    mov es, ax
+
+    mov ax, [ds:0x7dfe]
+    cmp ax, [es:0x7e0e]
+    jne .check_a20_done
+
+    ; The words may match by chance, so change one and compare them again.
+    ; Rotating leaves ZF alone.
+    rol word [ds:0x7dfe], 8
+    mov ax, [ds:0x7dfe]
+    cmp ax, [es:0x7e0e]
+    ror word [ds:0x7dfe], 8
+
+    .check_a20_done:
+        pop es
+        pop ds
+        ret
+
+; Enable the A20 line, so that addresses above 1 MiB don't wrap around. Hang if
+; it can't be enabled.
+enable_a20:
+    call check_a20
+    jnz .enable_a20_done
+
+    ; Ask the BIOS.
+    mov ax, 0x2401
+    int 0x15
+    call check_a20
+    jnz .enable_a20_done
+
+    ; Use the fast A20 gate in system control port A. Setting bit 0 would
+    ; reset the machine.
+    in al, 0x92
+    or al, 0x02
+    and al, 0xfe
+    out 0x92, al
+    call check_a20
+    jnz .enable_a20_done
+
+    mov bx, MSG_A20_ERROR
+    call println
+    jmp $
+
+    .enable_a20_done:
+        ret
+
+; Switch to unreal mode: load ds and es with 4 GiB limits in protected mode,
+; then switch back to real mode. The limits stay in the segment descriptor
+; caches until the segments are loaded in protected mode. All general purpose
+; registers are preserved.
+enter_unreal_mode:
+    cli
+    pushad
+    push ds
+    push es
+
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 0x01
+    mov cr0, eax
+
+    mov bx, DATA_SEG
+    mov ds, bx
+    mov es, bx
+
+    and al, 0xfe
+    mov cr0, eax
+
+    ; Back in real mode, restore the segment bases. The limits are kept.
+    pop es
+    pop ds
+    popad
+    sti
+    ret
+
+; Load the compressed kernel at COMPRESSED_OFFSET.
+load_kernel:
+    ; ax is the next sector to read, bp is the number of sectors left, and edi
+    ; is where to copy them to.
+    mov ax, KERNEL_LBA
+    mov bp, COMPRESSED_SECTORS
+    mov edi, COMPRESSED_OFFSET
+
+    .load_kernel_chunk:
+        mov cx, BUFFER_SECTORS
+        cmp cx, bp
+        jbe .load_kernel_read
+        mov cx, bp
+
+    .load_kernel_read:
+        mov bx, BUFFER_OFFSET >> 4
+        mov es, bx
+        call disk_load
+        add ax, cx
+        sub bp, cx
+
+        ; The BIOS may have left protected mode itself, and reset the segment
+        ; limits, so switch to unreal mode for every chunk.
+        xor bx, bx
+        mov es, bx
+        call enter_unreal_mode
+
+        ; Copy the chunk above 1 MiB, a dword at a time. A sector is 128
+        ; dwords.
+        mov esi, BUFFER_OFFSET
+        movzx ecx, cx
+        shl ecx, 7
+        cld
+        a32 rep movsd
+
+        test bp, bp
+        jnz .load_kernel_chunk
+
+    ret
+
+; Read the memory map from the BIOS with E820 calls, and fill in the
+; information passed to the kernel. The map is empty if E820 isn't supported.
+read_memory_map:
+    ; di is where the next entry goes, after its size field, and ebx is the
+    ; BIOS's position in the map, starting at 0.
+    xor ebx, ebx
+    mov es, bx
+    mov di, MMAP_OFFSET + 4
+
+    .read_memory_map_next:
+        mov eax, 0xe820
+        mov ecx, MMAP_ENTRY_SIZE - 4
+        mov edx, E820_SIGNATURE
+        int 0x15
+
+        ; Carry is set at the end of the map by some BIOSes, and on the first
+        ; call if E820 isn't supported.
+        jc .read_memory_map_done
+        cmp eax, E820_SIGNATURE
+        jne .read_memory_map_done
+
+        ; Skip empty entries.
+        mov eax, [di + 8]
+        or eax, [di + 12]
+        jz .read_memory_map_skip
+
+        mov dword [di - 4], MMAP_ENTRY_SIZE - 4
+        add di, MMAP_ENTRY_SIZE
+        cmp di, MMAP_OFFSET + 4 + MMAP_MAX_ENTRIES * MMAP_ENTRY_SIZE
+        jae .read_memory_map_done
+
+    .read_memory_map_skip:
+        ; ebx is 0 after the last entry.
+        test ebx, ebx
+        jnz .read_memory_map_next
+
+    .read_memory_map_done:
+        sub di, MMAP_OFFSET + 4
+        movzx edi, di
+        mov dword [BOOT_INFO_OFFSET + BOOT_INFO_FLAGS], BOOT_INFO_MEM_MAP
+        mov [BOOT_INFO_OFFSET + BOOT_INFO_MMAP_LENGTH], edi
+        mov dword [BOOT_INFO_OFFSET + BOOT_INFO_MMAP_ADDR], MMAP_OFFSET
+        ret
+
+%include "lz4.asm"
+
+[bits 32]
+; This is where we arrive after switching to and initialising protected mode.
+BEGIN_PM:
+    ; Decompress the kernel into place.
+    mov esi, COMPRESSED_OFFSET
+    mov ecx, COMPRESSED_SIZE
+    mov edi, KERNEL_OFFSET
+    call lz4_decompress
+
+    ; Now jump to the address of our loaded kernel code, passing it the memory
+    ; map.
+    mov eax, BOOT_MAGIC
+    mov ebx, BOOT_INFO_OFFSET
+    call KERNEL_OFFSET
+
+    ; Hang.
+    jmp $
+
+; Global variables.
+BOOT_DRIVE db 0
+MSG_LOAD_KERNEL db "Loading kernel", 0
+MSG_A20_ERROR db "Failed to enable A20", 0
+
+; Pad to a whole number of sectors, which are all loaded by the boot sector.
+align 512, db 0
+STAGE2_SECTORS equ ($ - $$) / 512
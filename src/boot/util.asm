@@ -46,20 +46,15 @@ println:
 clrscr:
 	pusha
 
-	mov ah, 0x06 ; scroll up function
-	mov al, 0x00 ; clear entire screen
-	mov bh, 0x07 ; attribute, assuming white on black
-	mov cx, 0x00 ; start row/column
-	mov dh, 24   ; end row
-	mov dl, 79   ; end column
+	mov ax, 0x0600 ; scroll up function (ah), clearing the entire screen (al)
+	mov bh, 0x07   ; attribute, assuming white on black
+	xor cx, cx     ; start row (ch) and column (cl)
+	mov dx, 0x184f ; end row (dh = 24) and column (dl = 79)
 	int 0x10
 
 	mov ah, 0x02 ; set cursor position function
-	mov al, 0x00 ; unused?
-	mov bh, 0x00 ; 0-3 in modes 2&3, 0-7 in modes 0&1, 0 in graphics modes
-	mov bl, 0x00 ; unused?
-	mov dh, 0x00 ; row: 0 is top
-	mov dl, 0x00 ; column: 0 is left
+	xor bh, bh   ; 0-3 in modes 2&3, 0-7 in modes 0&1, 0 in graphics modes
+	xor dx, dx   ; row (dh: 0 is top) and column (dl: 0 is left)
 	int 0x10
 
 	popa
@@ -69,9 +64,6 @@ clrscr:
 print_hex:
 	pusha
 
-	; use cx as counter; init to 3. Iterate decrementing cx until it reaches 0.
-	mov cx, 0x03
-
 	; init teletype mode
 	mov ah, 0x0e
 
@@ -81,137 +73,223 @@ print_hex:
 	mov al, 'x'
 	int 0x10
 
-	.print_hex_loop_start:
-		mov bx, dx
-
-		; right-bitshift by 12
-		shr bx, 0x0c
-
-		; rightmost nibble of bx now contains the c-th most significant
-		; nibble of dx
-		cmp bx, 0xf
-		jg .unknown_digit
-		cmp bx, 0
-		jl .unknown_digit
-
-		cmp bl, 9
-		jg .letter
-		jle .number
-
-		; This should never happen - it means the digit was <0 or >15
-		.unknown_digit:
-			mov bx, ERR_UNKNOWN
-			call println
-
-		; Execution should never reach here. This could be safely removed.
-		jmp .print_hex_end
-
-		.number:
-			add bl, '0'
-			jmp .print_hex_loop_end
-
-		.letter:
-			add bl, 0x57 ; 0x57 = 87d, 'a' is 97d
-			jmp .print_hex_loop_end
-
-		.print_hex_loop_end:
-			mov al, bl
-			int 0x10
-
-			; left-bitshift bl 4 times to bring next nibble to MSD
-			shl dx, 0x04
-
-			; finish loop if cx == 0 (ie 4th iteration).
-			cmp cx, 0
-			je .print_hex_end
-
-			; decrement counter
-			dec cx
-
-			jmp .print_hex_loop_start
+	; Rotate each nibble of dx, most significant first, into the bottom of dl.
+	mov cx, 4
+	.print_hex_loop:
+		rol dx, 4
+		mov al, dl
+		and al, 0x0f
+		add al, '0'
+		cmp al, '9'
+		jbe .print_hex_digit
+		add al, 'a' - '9' - 1
+
+	.print_hex_digit:
+		int 0x10
+		loop .print_hex_loop
 
-	.print_hex_end:
-		popa
-		ret
+	popa
+	ret
 
 println_hex:
 	call print_hex
 	call print_lf
 	ret
 
-ERR_UNKNOWN:
-	db 'Unknown digit', 0
+; Number of times a read of a single sector or track is attempted before
+; giving up. Floppy drives may need a few attempts while the motor spins up.
+DISK_RETRIES equ 3
 
-; Read from disk.
+; Read sectors from the boot disk. Extended (LBA) reads are used if the BIOS
+; supports them, in chunks of as many sectors as it accepts. Otherwise, the
+; disk geometry is queried and sectors are read a track at a time. The disk is
+; reset after every failed read.
 ; Inputs:
-; dh: Number of sectors to read
-; dl: Disk from which to read.
+; ax: LBA of the first sector to read.
+; cx: Number of sectors to read.
+; es: Segment to read into, from offset 0. The sectors must fit below 1 MiB.
 disk_load:
-	; Store DX on the stack so later we can recall how many sectors were
-	; requested to be read, even if it is altered in this function.
-	push dx
-
-	; BIOS read sector function.
-	mov ah, 0x02
+	pusha
+	push es
 
-	; Number of sectors to read.
-	mov al, dh
+	mov [dap_lba], ax
+	mov [dap_segment], es
 
-	; Select cylinder 0.
-	mov ch, 0x00
+	; bp counts the sectors left to read.
+	mov bp, cx
 
-	; Select head 0.
-	mov dh, 0x00
+	; Check for the INT 13h extensions, and for the extended read function.
+	mov ah, 0x41
+	mov bx, 0x55aa
+	mov dl, [BOOT_DRIVE]
+	int 0x13
+	jc disk_load_chs
+	cmp bx, 0xaa55
+	jne disk_load_chs
+	test cl, 1
+	jz disk_load_chs
+
+	disk_load_lba_max:
+		; di is the most sectors to read at once. Many BIOSes reject more
+		; than 127 sectors per call, which is also the most that fits in a
+		; segment. A failed read only limits the chunk that follows it.
+		mov di, 127
+		mov byte [disk_tries], DISK_RETRIES
+
+	disk_load_lba:
+		mov cx, di
+		cmp cx, bp
+		jbe disk_load_lba_read
+		mov cx, bp
+
+	disk_load_lba_read:
+		mov [dap_count], cx
+		mov si, dap
+		mov ah, 0x42
+		mov dl, [BOOT_DRIVE]
+		int 0x13
+		jnc disk_load_lba_next
+
+		; The BIOS may not accept this many sectors at once, eg if they cross
+		; a 64 KiB DMA boundary. Retry with half as many, and once a single
+		; sector fails, retry it a few times before giving up.
+		call disk_reset
+		shr di, 1
+		jnz disk_load_lba
+		inc di
+		dec byte [disk_tries]
+		jnz disk_load_lba
+		jmp disk_error
+
+	disk_load_lba_next:
+		call disk_load_advance
+		jnz disk_load_lba_max
+		jmp disk_load_done
+
+	disk_load_chs:
+		; Get the number of sectors per track, and the number of heads. es:di
+		; should be 0 to work around some BIOSes.
+		xor di, di
+		mov es, di
+		mov ah, 0x08
+		mov dl, [BOOT_DRIVE]
+		int 0x13
+		jc disk_error
+		and cl, 0x3f
+		mov [disk_sectors_per_track], cl
+		inc dh
+		mov [disk_heads], dh
+
+	disk_load_chs_track:
+		; Split the LBA into the sector (dx), and the track (ax).
+		mov ax, [dap_lba]
+		xor dx, dx
+		xor bh, bh
+		mov bl, [disk_sectors_per_track]
+		div bx
+
+		; Read up to the end of the track.
+		mov cx, bx
+		sub cx, dx
+		cmp cx, bp
+		jbe disk_load_chs_read
+		mov cx, bp
+
+	disk_load_chs_read:
+		mov [dap_count], cx
+
+		; Sectors are numbered from 1.
+		inc dx
+		mov cl, dl
+
+		; Split the track into the cylinder (ax), and the head (dx).
+		xor dx, dx
+		mov bl, [disk_heads]
+		div bx
+
+		; The cylinder is 10 bits, with the top 2 in the top of cl.
+		mov ch, al
+		shl ah, 6
+		or cl, ah
+		mov dh, dl
+		mov dl, [BOOT_DRIVE]
+
+		mov es, [dap_segment]
+		xor bx, bx
+		mov byte [disk_tries], DISK_RETRIES
+
+	disk_load_chs_retry:
+		mov al, [dap_count]
+		mov ah, 0x02
+		int 0x13
+		jnc disk_load_chs_next
+
+		call disk_reset
+		dec byte [disk_tries]
+		jnz disk_load_chs_retry
+		jmp disk_error
+
+	disk_load_chs_next:
+		call disk_load_advance
+		jnz disk_load_chs_track
+
+	disk_load_done:
+		pop es
+		popa
+		ret
 
-	; Start reading from the second sector (ie after the boot sector).
-	mov cl, 0x02
+; Move past the sectors just read, which are counted in dap_count. Clears ZF if
+; there are more to read.
+disk_load_advance:
+	mov cx, [dap_count]
+	add [dap_lba], cx
 
-	; Raise the BIOS interrupt to execute the read.
-	int 0x13
+	; A sector is 32 paragraphs.
+	shl cx, 5
+	add [dap_segment], cx
+	shr cx, 5
 
-	; Jump iff the carry flag was set.
-	jc disk_error
+	sub bp, cx
+	ret
 
-	disk_load_success:
-		; Restore dx from the stack.
-		pop dx
-		ret
+; Reset the boot disk after a failed read. All registers are preserved, so ah
+; still holds the error code of the read.
+disk_reset:
+	pusha
+	xor ah, ah
+	mov dl, [BOOT_DRIVE]
+	int 0x13
+	popa
+	ret
 
-	disk_nsect_error:
-		mov bx, DISK_ERROR_MSG
-		call print
-		mov bx, DISK_ERROR_MSG_CTX
-		call print
-		mov bx, DISK_ERROR_MSG_NSECT
-		call println
-		jmp $
-
-	disk_error:
-		; The number of sectors we actually read is stored in al.
-		; TODO: if this doesn't match the expected number of sectors, should we
-		; error out? For now, I'll treat this as success, otherwise when loading
-		; the kernel we would need to count the number of sectors occupied by
-		; the kernel every time we recompile it.
-
-		; Check if we read the correct number of sectors.
-		cmp al, dh
-		jne disk_load_success
-		; jne disk_nsect_error
-
-		mov bx, DISK_ERROR_MSG
-		call print
-		mov bx, DISK_ERROR_MSG_CTX
-		call print
-		mov dh, ah
-		mov dl, 0x00
-		call println_hex
-		jmp $
+; Print the error code in ah, and hang.
+disk_error:
+	mov bx, DISK_ERROR_MSG
+	call print
+	mov dh, ah
+	mov dl, 0x00
+	call println_hex
+	jmp $
+
+; Disk address packet, passed to the extended read function. It also tracks
+; the next sector to read, and where to, when reading by CHS.
+dap:
+	db 0x10 ; size of the packet
+	db 0x00
+dap_count: dw 0
+dap_offset: dw 0
+dap_segment: dw 0
+dap_lba: dq 0
+
+; Disk geometry, used when reading by CHS.
+disk_sectors_per_track: db 0
+disk_heads: db 0
+
+; Attempts left at the current read.
+disk_tries: db 0
 
 ; Global variables
-DISK_ERROR_MSG: db "Disk read error", 0
-DISK_ERROR_MSG_CTX: db ": ", 0
-DISK_ERROR_MSG_NSECT: db "Failed to read specified number of sectors", 0
-DISK_ERROR_MSG_GENERIC: db "i/o error", 0
+DISK_ERROR_MSG: db "Disk read error: ", 0
 
 ; Error codes:
 ; 0x00	successful completion
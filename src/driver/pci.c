@@ -0,0 +1,400 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pci.h"
+#include "rsdt.h"
+
+#include "low_level.h"
+#include "vga.h"
+
+// I/O ports of the legacy configuration mechanism. The address of a register is
+// written to PCI_CONFIG_ADDRESS, and then the register is accessed through
+// PCI_CONFIG_DATA.
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// Set in PCI_CONFIG_ADDRESS to enable the access.
+#define CONFIG_ENABLE 0x80000000
+
+// Size of the legacy configuration space of a function. The memory-mapped
+// configuration space is 4 KiB.
+#define LEGACY_CONFIG_SIZE 0x100
+
+#define MAX_BUSES 256
+#define MAX_DEVICES 32
+#define MAX_FUNCTIONS 8
+
+// Header type register: the device has more than one function.
+#define HEADER_MULTI_FUNCTION 0x80
+#define HEADER_TYPE_MASK 0x7f
+#define HEADER_TYPE_DEVICE 0x00
+#define HEADER_TYPE_BRIDGE 0x01
+
+// Class and subclass of a host bridge. Host bridges are left decoding while
+// their BARs are sized, as some of them stop forwarding memory accesses to
+// RAM otherwise.
+#define CLASS_BRIDGE 0x06
+#define SUBCLASS_HOST_BRIDGE 0x00
+
+// Number of BARs in a type 1 (PCI-to-PCI bridge) header.
+#define BRIDGE_NUM_BARS 2
+
+// BAR bits.
+#define BAR_IO 0x01
+#define BAR_MEM_TYPE_MASK 0x06
+#define BAR_MEM_TYPE_64 0x04
+#define BAR_MEM_PREFETCHABLE 0x08
+#define BAR_IO_ADDRESS_MASK 0xfffffffc
+#define BAR_MEM_ADDRESS_MASK 0xfffffff0
+
+// Maximum number of MCFG entries used. Each covers a range of buses.
+#define MAX_ECAM_REGIONS 4
+
+typedef struct {
+    uint64_t base_address;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed)) mcfg_entry_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint64_t reserved;
+    mcfg_entry_t entries[];
+} __attribute__((packed)) mcfg_t;
+
+const char MCFG_SIGNATURE[SDT_HEADER_LEN] = "MCFG";
+
+// A range of buses with memory-mapped configuration space (ECAM). Every
+// function has 4 KiB of configuration space, at base + (bus << 20) +
+// (device << 15) + (function << 12).
+typedef struct {
+    uintptr_t base;
+    uint8_t start_bus;
+    uint8_t end_bus;
+} ecam_region_t;
+
+static ecam_region_t ecam_regions[MAX_ECAM_REGIONS];
+static uint8_t num_ecam_regions = 0;
+
+// Whether the legacy configuration mechanism exists.
+static bool have_ports = false;
+
+static pci_device_t devices[PCI_MAX_DEVICES];
+static uint32_t num_devices = 0;
+
+/*
+Record the memory-mapped configuration space of PCI segment 0 described by the
+MCFG table, if there is one.
+*/
+static void parse_mcfg() {
+    mcfg_t *mcfg = (mcfg_t *)get_sdt(MCFG_SIGNATURE);
+    if (!mcfg || mcfg->header.length < sizeof(mcfg_t)) {
+        return;
+    }
+
+    uint32_t n = (mcfg->header.length - sizeof(mcfg_t)) / sizeof(mcfg_entry_t);
+    for (uint32_t i = 0; i < n && num_ecam_regions < MAX_ECAM_REGIONS; i++) {
+        mcfg_entry_t *entry = &mcfg->entries[i];
+
+        // Other segments can't be reached through the legacy mechanism either,
+        // so they're ignored.
+        if (entry->segment != 0 || entry->start_bus > entry->end_bus) {
+            continue;
+        }
+
+        // Addresses above 4 GiB are unreachable without PAE.
+        uint64_t end = entry->base_address + ((uint64_t)(entry->end_bus + 1) << 20);
+        if (end >> 32) {
+            continue;
+        }
+
+        ecam_region_t *region = &ecam_regions[num_ecam_regions++];
+        region->base = (uintptr_t)entry->base_address;
+        region->start_bus = entry->start_bus;
+        region->end_bus = entry->end_bus;
+    }
+}
+
+/*
+Check whether the legacy configuration mechanism exists: if so, the address
+register reads back what was written to it.
+*/
+static bool probe_ports() {
+    uint32_t saved = read_dword(PCI_CONFIG_ADDRESS);
+    write_dword(PCI_CONFIG_ADDRESS, CONFIG_ENABLE);
+    bool exists = read_dword(PCI_CONFIG_ADDRESS) == CONFIG_ENABLE;
+    write_dword(PCI_CONFIG_ADDRESS, saved);
+    return exists;
+}
+
+/*
+Get the address of a register in the memory-mapped configuration space, or
+NULL if the bus isn't covered by the MCFG table.
+*/
+static volatile uint32_t *ecam_address(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+    for (uint8_t i = 0; i < num_ecam_regions; i++) {
+        ecam_region_t *region = &ecam_regions[i];
+        if (bus >= region->start_bus && bus <= region->end_bus) {
+            return (volatile uint32_t *)(region->base + ((uint32_t)bus << 20) +
+                    ((uint32_t)device << 15) + ((uint32_t)function << 12) + offset);
+        }
+    }
+    return 0;
+}
+
+static uint32_t port_address(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+    return CONFIG_ENABLE | ((uint32_t)bus << 16) | ((uint32_t)device << 11) |
+            ((uint32_t)function << 8) | (offset & 0xfc);
+}
+
+uint32_t pci_config_read(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+    // ECAM needs a single memory access, rather than two serialised port
+    // accesses.
+    volatile uint32_t *reg = ecam_address(bus, device, function, offset);
+    if (reg) {
+        return *reg;
+    }
+
+    if (!have_ports || offset >= LEGACY_CONFIG_SIZE) {
+        return 0xffffffff;
+    }
+    write_dword(PCI_CONFIG_ADDRESS, port_address(bus, device, function, offset));
+    return read_dword(PCI_CONFIG_DATA);
+}
+
+void pci_config_write(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value) {
+    volatile uint32_t *reg = ecam_address(bus, device, function, offset);
+    if (reg) {
+        *reg = value;
+        return;
+    }
+
+    if (!have_ports || offset >= LEGACY_CONFIG_SIZE) {
+        return;
+    }
+    write_dword(PCI_CONFIG_ADDRESS, port_address(bus, device, function, offset));
+    write_dword(PCI_CONFIG_DATA, value);
+}
+
+static uint32_t read_config(const pci_device_t *dev, uint16_t offset) {
+    return pci_config_read(dev->bus, dev->device, dev->function, offset);
+}
+
+static void write_config(const pci_device_t *dev, uint16_t offset, uint32_t value) {
+    pci_config_write(dev->bus, dev->device, dev->function, offset, value);
+}
+
+/*
+Read a BAR, and the mask of its address bits, by writing all ones to it and
+reading back which bits stuck. The BAR is restored afterwards.
+*/
+static uint32_t size_bar(const pci_device_t *dev, uint16_t offset, uint32_t *mask) {
+    uint32_t value = read_config(dev, offset);
+    write_config(dev, offset, 0xffffffff);
+    *mask = read_config(dev, offset);
+    write_config(dev, offset, value);
+    return value;
+}
+
+/*
+Decode the BARs of a function.
+*/
+static void decode_bars(pci_device_t *dev) {
+    uint8_t nbars = (dev->header_type & HEADER_TYPE_MASK) == HEADER_TYPE_BRIDGE ? BRIDGE_NUM_BARS : PCI_NUM_BARS;
+    for (uint8_t i = 0; i < PCI_NUM_BARS; i++) {
+        dev->bars[i].type = PCI_BAR_NONE;
+        dev->bars[i].base = 0;
+        dev->bars[i].size = 0;
+        dev->bars[i].prefetchable = false;
+    }
+    if ((dev->header_type & HEADER_TYPE_MASK) > HEADER_TYPE_BRIDGE) {
+        return;
+    }
+
+    // Stop the function decoding addresses while its BARs hold all ones,
+    // unless it's a host bridge. The status register shares the dword, and
+    // its bits are cleared by writing 1, so it's written as 0. Interrupts are
+    // disabled meanwhile, so that no handler touches a device which isn't
+    // decoding, or one whose BARs hold all ones.
+    uint32_t flags = irq_save();
+    uint32_t command = read_config(dev, PCI_COMMAND) & 0xffff;
+    bool host_bridge = dev->class_code == CLASS_BRIDGE && dev->subclass == SUBCLASS_HOST_BRIDGE;
+    if (!host_bridge) {
+        write_config(dev, PCI_COMMAND, command & ~(uint32_t)(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+    }
+
+    for (uint8_t i = 0; i < nbars; i++) {
+        pci_bar_t *bar = &dev->bars[i];
+        uint16_t offset = PCI_BAR0 + i * 4;
+        uint32_t mask;
+        uint32_t value = size_bar(dev, offset, &mask);
+
+        if (value & BAR_IO) {
+            mask &= BAR_IO_ADDRESS_MASK;
+            if (!mask) {
+                continue;
+            }
+            // The upper 16 bits of an I/O BAR may be hardwired to 0.
+            if (!(mask >> 16)) {
+                mask |= 0xffff0000;
+            }
+            bar->type = PCI_BAR_IO;
+            bar->base = value & BAR_IO_ADDRESS_MASK;
+            bar->size = (uint32_t)(~mask + 1);
+            continue;
+        }
+
+        uint64_t base = value & BAR_MEM_ADDRESS_MASK;
+        uint64_t mask64 = 0xffffffff00000000ull | (mask & BAR_MEM_ADDRESS_MASK);
+        bool implemented = mask & BAR_MEM_ADDRESS_MASK;
+        bar->type = PCI_BAR_MEM32;
+        bar->prefetchable = value & BAR_MEM_PREFETCHABLE;
+
+        // A 64-bit BAR takes the next BAR as its upper half.
+        if ((value & BAR_MEM_TYPE_MASK) == BAR_MEM_TYPE_64 && i + 1 < nbars) {
+            uint32_t high_mask;
+            uint32_t high = size_bar(dev, offset + 4, &high_mask);
+            base |= (uint64_t)high << 32;
+            mask64 = ((uint64_t)high_mask << 32) | (mask & BAR_MEM_ADDRESS_MASK);
+            implemented |= high_mask != 0;
+            bar->type = PCI_BAR_MEM64;
+            i++;
+        }
+
+        if (!implemented) {
+            bar->type = PCI_BAR_NONE;
+            bar->prefetchable = false;
+            continue;
+        }
+        bar->base = base;
+        bar->size = ~mask64 + 1;
+    }
+
+    if (!host_bridge) {
+        write_config(dev, PCI_COMMAND, command);
+    }
+    irq_restore(flags);
+}
+
+/*
+Record a function which exists.
+*/
+static void add_device(uint8_t bus, uint8_t device, uint8_t function, uint32_t id) {
+    if (num_devices >= PCI_MAX_DEVICES) {
+        println("PCI: too many devices; ignoring %02x:%02x.%u", bus, device, function);
+        return;
+    }
+
+    pci_device_t *dev = &devices[num_devices++];
+    dev->bus = bus;
+    dev->device = device;
+    dev->function = function;
+    dev->vendor_id = id & 0xffff;
+    dev->device_id = id >> 16;
+
+    uint32_t class = read_config(dev, PCI_REVISION);
+    dev->revision = class & 0xff;
+    dev->prog_if = (class >> 8) & 0xff;
+    dev->subclass = (class >> 16) & 0xff;
+    dev->class_code = class >> 24;
+
+    dev->header_type = (read_config(dev, PCI_HEADER_TYPE & ~3) >> 16) & 0xff;
+    dev->irq_line = read_config(dev, PCI_INTERRUPT_LINE) & 0xff;
+    dev->driver = 0;
+
+    decode_bars(dev);
+}
+
+/*
+Record every function of every device on every bus. Buses are scanned by brute
+force, rather than by following bridges, so that nothing is missed if the
+firmware numbered the buses unusually.
+*/
+static void enumerate() {
+    for (uint32_t bus = 0; bus < MAX_BUSES; bus++) {
+        for (uint8_t device = 0; device < MAX_DEVICES; device++) {
+            uint32_t id = pci_config_read(bus, device, 0, PCI_VENDOR_ID);
+            if ((id & 0xffff) == 0xffff) {
+                continue;
+            }
+
+            uint8_t header_type = (pci_config_read(bus, device, 0, PCI_HEADER_TYPE & ~3) >> 16) & 0xff;
+            uint8_t nfunctions = header_type & HEADER_MULTI_FUNCTION ? MAX_FUNCTIONS : 1;
+
+            add_device(bus, device, 0, id);
+            for (uint8_t function = 1; function < nfunctions; function++) {
+                id = pci_config_read(bus, device, function, PCI_VENDOR_ID);
+                if ((id & 0xffff) != 0xffff) {
+                    add_device(bus, device, function, id);
+                }
+            }
+        }
+    }
+}
+
+void pci_init() {
+    num_ecam_regions = 0;
+    num_devices = 0;
+
+    parse_mcfg();
+    have_ports = probe_ports();
+
+    if (!num_ecam_regions && !have_ports) {
+        println("PCI: no configuration space found");
+        return;
+    }
+
+    enumerate();
+    println("PCI: found %u functions, using %s configuration access", num_devices,
+            num_ecam_regions ? "memory-mapped" : "port");
+}
+
+uint32_t pci_get_num_devices() {
+    return num_devices;
+}
+
+pci_device_t *pci_get_device(uint32_t i) {
+    return &devices[i];
+}
+
+uint32_t pci_register_driver(const pci_driver_t *driver) {
+    uint32_t bound = 0;
+    for (uint32_t i = 0; i < num_devices; i++) {
+        pci_device_t *dev = &devices[i];
+        if (dev->driver) {
+            continue;
+        }
+        if (driver->vendor_id != PCI_ANY_ID && driver->vendor_id != dev->vendor_id) {
+            continue;
+        }
+        if (driver->device_id != PCI_ANY_ID && driver->device_id != dev->device_id) {
+            continue;
+        }
+
+        if (driver->probe(dev)) {
+            dev->driver = driver;
+            bound++;
+        }
+    }
+    return bound;
+}
+
+void pci_print_devices() {
+    for (uint32_t i = 0; i < num_devices; i++) {
+        pci_device_t *dev = &devices[i];
+        println("%02x:%02x.%u %04x:%04x class %02x:%02x:%02x %s", dev->bus, dev->device,
+                dev->function, dev->vendor_id, dev->device_id, dev->class_code,
+                dev->subclass, dev->prog_if, dev->driver ? dev->driver->name : "");
+
+        for (uint8_t j = 0; j < PCI_NUM_BARS; j++) {
+            pci_bar_t *bar = &dev->bars[j];
+            if (bar->type == PCI_BAR_NONE) {
+                continue;
+            }
+            println("  BAR%u: %s %llx size %llx%s", j, bar->type == PCI_BAR_IO ? "io" : "mem",
+                    bar->base, bar->size, bar->prefetchable ? " prefetchable" : "");
+        }
+    }
+}
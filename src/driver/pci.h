@@ -0,0 +1,145 @@
+#ifndef _DREWOS_PCI_H_
+#define _DREWOS_PCI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum number of functions recorded by pci_init(). Any more are ignored.
+#define PCI_MAX_DEVICES 64
+
+// Number of BARs in a type 0 (general device) header. Bridges only have 2.
+#define PCI_NUM_BARS 6
+
+// Matches any vendor or device ID in a pci_driver_t.
+#define PCI_ANY_ID 0xffff
+
+// Offsets of registers in the configuration space header.
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0e
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3c
+
+// Command register bits.
+#define PCI_COMMAND_IO (1 << 0)
+#define PCI_COMMAND_MEMORY (1 << 1)
+#define PCI_COMMAND_MASTER (1 << 2)
+
+typedef enum {
+    // The BAR is unimplemented, or is the upper half of a 64-bit BAR.
+    PCI_BAR_NONE,
+    PCI_BAR_IO,
+    PCI_BAR_MEM32,
+    PCI_BAR_MEM64
+} pci_bar_type_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t size;
+    pci_bar_type_t type;
+    bool prefetchable;
+} pci_bar_t;
+
+struct pci_driver;
+
+// A PCI function found by pci_init().
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint8_t header_type;
+
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+
+    // The legacy (PIC) IRQ which the function's interrupt pin is routed to, or
+    // 0xff if it has none.
+    uint8_t irq_line;
+
+    pci_bar_t bars[PCI_NUM_BARS];
+
+    // The driver bound to the function, or NULL.
+    const struct pci_driver *driver;
+} pci_device_t;
+
+// A driver for PCI functions with a particular vendor and device ID.
+typedef struct pci_driver {
+    const char *name;
+
+    // IDs of the functions which the driver supports. Either may be
+    // PCI_ANY_ID.
+    uint16_t vendor_id;
+    uint16_t device_id;
+
+    // Called for each matching function which has no driver. Return true to
+    // bind the driver to the function.
+    bool (*probe)(pci_device_t *dev);
+} pci_driver_t;
+
+/*
+Find the PCI configuration space, and record every function on every bus, with
+its BARs decoded. The memory-mapped configuration space described by the ACPI
+MCFG table is used if there is one, and the legacy I/O ports otherwise. This
+must be called after acpi_init().
+*/
+void pci_init();
+
+/*
+Read a dword from a function's configuration space. Return 0xffffffff if the
+function doesn't exist, or the register isn't accessible. This must not be
+called from interrupt context.
+
+@param bus: The bus.
+@param device: The device on the bus (0-31).
+@param function: The function of the device (0-7).
+@param offset: Offset of the register. Must be a multiple of 4. Registers at
+or above 0x100 are only accessible through the memory-mapped configuration
+space.
+*/
+uint32_t pci_config_read(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+
+/*
+Write a dword to a function's configuration space. This must not be called
+from interrupt context.
+
+@param bus: The bus.
+@param device: The device on the bus (0-31).
+@param function: The function of the device (0-7).
+@param offset: Offset of the register. Must be a multiple of 4.
+@param value: The value to be written.
+*/
+void pci_config_write(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value);
+
+/*
+Get the number of functions found by pci_init().
+*/
+uint32_t pci_get_num_devices();
+
+/*
+Get the i-th function found by pci_init(), in bus, device and function order.
+
+@param i: Index of the function. Must be less than pci_get_num_devices().
+*/
+pci_device_t *pci_get_device(uint32_t i);
+
+/*
+Offer every unbound function with a matching vendor and device ID to a driver.
+Return the number of functions the driver was bound to.
+
+@param driver: The driver. This must remain valid forever.
+*/
+uint32_t pci_register_driver(const pci_driver_t *driver);
+
+/*
+Print every function found by pci_init().
+*/
+void pci_print_devices();
+
+#endif // _DREWOS_PCI_H_
@@ -1,8 +1,15 @@
 
 #include "ps2.h"
 #include "ps2_keyboard.h"
+#include "ps2_mouse.h"
 
 #include "low_level.h"
+#include "clock.h"
+#include "idle.h"
+#include "idt.h"
+#include "pic.h"
+#include "ring.h"
+#include "timer.h"
 #include "vga.h"
 #include "util.h"
 
@@ -70,8 +77,35 @@
 
 // Other constants.
 
-// Default max number of iterations to wait for the device to become ready.
-#define DEFAULT_WAIT 1024
+// Maximum time to wait for the controller to become ready.
+#define PS2_TIMEOUT_US 20000
+
+// IRQs raised when a byte arrives from the device in each port.
+#define PS2_IRQ_PORT0 1
+#define PS2_IRQ_PORT1 12
+
+#define PS2_NPORTS 2
+
+// Number of commands which can be queued for each port.
+#define PS2_QUEUE_SIZE 8
+
+// Size of the ring of bytes received from each port. Must be a power of 2. A
+// mouse at 200 samples/s sends 800 bytes/s, so this covers a stall of over a
+// quarter of a second in the idle loop.
+#define PS2_RING_SIZE 256
+
+// Number of times a command is resent at the device's request before giving up.
+#define PS2_MAX_RETRIES 3
+
+// Default time allowed for a device command.
+#define PS2_CMD_TIMEOUT_MS 100
+
+// Time allowed for a device to reset itself. This takes up to half a second.
+#define PS2_RESET_TIMEOUT_MS 1000
+
+// Once a command has its minimum number of response bytes, it completes if no
+// more arrive within this time.
+#define PS2_SETTLE_MS 20
 
 // An "acknowledge" response.
 #define RESP_ACK 0xfa
@@ -82,6 +116,9 @@
 #define RESP_RESET_SUCCESS 0xaa
 #define RESP_RESET_FAIL 0xfc
 
+// Device ID given to keyboards which don't respond to the identify command.
+#define ID_AT_KEYBOARD 0xffff
+
 // Data types.
 
 typedef struct {
@@ -174,6 +211,46 @@ typedef enum {
     DEV_UNKNOWN
 } device_type_t;
 
+// Progress of the command at the front of a port's queue.
+typedef enum {
+    // Waiting for the command to be acknowledged.
+    STAGE_CMD,
+    // Waiting for the command's argument to be acknowledged.
+    STAGE_ARG,
+    // Waiting for the response bytes.
+    STAGE_RESPONSE
+} stage_t;
+
+// State of the device in each port.
+typedef struct {
+    port_t port;
+
+    // Bytes received from the device, and the time at which each arrived,
+    // written by the IRQ handler and read by ps2_poll().
+    byte_ring_t ring;
+    uint8_t ring_buf[PS2_RING_SIZE];
+    uint64_t ring_stamps[PS2_RING_SIZE];
+
+    // Commands waiting to be sent. The command at qhead is in progress if
+    // busy is set.
+    ps2_command_t queue[PS2_QUEUE_SIZE];
+    uint8_t qhead;
+    uint8_t qlen;
+    bool busy;
+
+    stage_t stage;
+    uint8_t resp[PS2_MAX_RESPONSE];
+    uint8_t nresp;
+    uint8_t retries;
+
+    // Deadline of the command in progress.
+    ktimer_t timer;
+
+    ps2_receiver_t receiver;
+} ps2_port_t;
+
+static ps2_port_t ports[PS2_NPORTS];
+
 static bool port_0_operational = false;
 static bool port_1_operational = false;
 static bool dual_channel = false;
@@ -190,6 +267,7 @@ static device_kind_t get_device_kind(device_type_t type) {
         case MOUSE_SCROLL_WHEEL:
         case MOUSE_5BUTTON:
             return MOUSE;
+        case KBD_AT:
         case KBD_MF2:
         case KBD_SHORT:
         case KBD_N97:
@@ -230,6 +308,8 @@ static device_type_t get_device_type(uint16_t device_id) {
             return KBD_JPN_A;
         case 0xaca1:
             return KBD_NCD_SUN;
+        case ID_AT_KEYBOARD:
+            return KBD_AT;
         default:
             return DEV_UNKNOWN;
     }
@@ -285,16 +365,26 @@ static bool response_ready() {
     return get_status() & 0x01;
 }
 
+/*
+Wait until ready() returns true, or PS2_TIMEOUT_US has passed. Return false on
+timeout.
+*/
+static bool wait_until(bool (*ready)()) {
+    uint64_t deadline = ktime_ns() + (uint64_t)PS2_TIMEOUT_US * NSEC_PER_USEC;
+    while (!ready()) {
+        if (ktime_ns() >= deadline) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ps2_buffer_wait() {
-    uint32_t wait = DEFAULT_WAIT;
-    while (!command_ready() && wait--);
-    return wait;
+    return wait_until(command_ready);
 }
 
 static bool response_wait() {
-    uint32_t wait = DEFAULT_WAIT;
-    while (!response_ready() && wait--);
-    return wait;
+    return wait_until(response_ready);
 }
 
 static bool try_read_data(uint8_t *data) {
@@ -332,24 +422,185 @@ void ps2_send_command(uint8_t command) {
     write_byte(PORT_COMMAND, command);
 }
 
-void ps2_send_device_command(uint8_t cmd, port_t port) {
+/*
+Write a byte to the device in a port.
+*/
+static void write_device(port_t port, uint8_t byte) {
     if (port == PORT1) {
         ps2_send_command(CMD_WRITE_INPUT_PORT_1);
     }
-    ps2_send_data(cmd);
+    ps2_send_data(byte);
+}
+
+/*
+Send the byte of the command in progress which is waiting to be acknowledged,
+and (re)start its deadline.
+*/
+static void send_current(ps2_port_t *p) {
+    ps2_command_t *cmd = &p->queue[p->qhead];
+    write_device(p->port, p->stage == STAGE_ARG ? cmd->arg : cmd->cmd);
+    timer_add(&p->timer, timer_deadline_ms(cmd->timeout_ms));
+}
 
-    uint8_t resp = 0;
-    bool has_resp = try_read_data(&resp);
-    if (has_resp && resp != RESP_ACK) {
-        if (resp == RESP_RESEND) {
-            ps2_send_device_command(cmd, port);
+static void start_next(ps2_port_t *p) {
+    if (p->busy || !p->qlen) {
+        return;
+    }
+
+    p->busy = true;
+    p->stage = STAGE_CMD;
+    p->nresp = 0;
+    p->retries = 0;
+    send_current(p);
+}
+
+/*
+Finish the command in progress, and start the next one.
+*/
+static void complete(ps2_port_t *p, ps2_cmd_status_t status) {
+    timer_del(&p->timer);
+
+    // The function may queue more commands, so take the command and its
+    // response out of the queue first.
+    ps2_command_t cmd = p->queue[p->qhead];
+    uint8_t resp[PS2_MAX_RESPONSE];
+    uint8_t nresp = p->nresp;
+    for (uint8_t i = 0; i < nresp; i++) {
+        resp[i] = p->resp[i];
+    }
+
+    p->qhead = (p->qhead + 1) % PS2_QUEUE_SIZE;
+    p->qlen--;
+    p->busy = false;
+
+    if (cmd.done) {
+        cmd.done(p->port, status, resp, nresp, cmd.data);
+    }
+    start_next(p);
+}
+
+/*
+Handle a byte from a device with a command in progress.
+*/
+static void command_receive(ps2_port_t *p, uint8_t byte, uint64_t timestamp) {
+    ps2_command_t *cmd = &p->queue[p->qhead];
+
+    if (p->stage != STAGE_RESPONSE) {
+        if (byte == RESP_ACK) {
+            if (p->stage == STAGE_CMD && cmd->has_arg) {
+                p->stage = STAGE_ARG;
+                send_current(p);
+                return;
+            }
+            p->stage = STAGE_RESPONSE;
+        } else if (byte == RESP_RESEND) {
+            if (p->retries++ >= PS2_MAX_RETRIES) {
+                complete(p, PS2_CMD_ERROR);
+            } else {
+                send_current(p);
+            }
+            return;
+        } else if (cmd->cmd == CMD_RESET_DEVICE) {
+            // Some devices send the result of their self-test before the ACK.
+            if (p->nresp < PS2_MAX_RESPONSE) {
+                p->resp[p->nresp++] = byte;
+            }
+            return;
         } else {
-            println("Error: device %d command %x failed; expected ACK (0xFA), but received %x", port, cmd, resp);
+            // Anything else, eg a scan code, was sent before the device saw
+            // the command.
+            if (p->receiver) {
+                p->receiver(p->port, byte, timestamp);
+            }
+            return;
         }
-    } else if (!has_resp) {
-        // Timeout while waiting for a response.
-        println("Error: device %d command %x did not generate a response (timeout)", port, cmd);
+    } else if (p->nresp < PS2_MAX_RESPONSE) {
+        p->resp[p->nresp++] = byte;
+    }
+
+    if (p->nresp >= cmd->max_resp) {
+        complete(p, PS2_CMD_OK);
+    } else if (p->nresp >= cmd->min_resp) {
+        // Give the device a moment to send any optional bytes.
+        timer_add(&p->timer, timer_deadline_ms(PS2_SETTLE_MS));
+    }
+}
+
+/*
+Pass the bytes received from a device to the command in progress, or to the
+device's driver.
+*/
+static void drain_port(ps2_port_t *p) {
+    uint8_t byte;
+    uint64_t timestamp;
+    while (byte_ring_get_stamped(&p->ring, &byte, &timestamp)) {
+        if (p->busy) {
+            command_receive(p, byte, timestamp);
+        } else if (p->receiver) {
+            p->receiver(p->port, byte, timestamp);
+        }
+    }
+}
+
+static void command_timeout(void *data) {
+    ps2_port_t *p = data;
+
+    // The response may have arrived, but not yet been seen by ps2_poll().
+    drain_port(p);
+    if (!p->busy || timer_pending(&p->timer)) {
+        return;
+    }
+
+    ps2_command_t *cmd = &p->queue[p->qhead];
+    bool ok = p->stage == STAGE_RESPONSE && p->nresp >= cmd->min_resp;
+    complete(p, ok ? PS2_CMD_OK : PS2_CMD_TIMEOUT);
+}
+
+static bool ps2_poll() {
+    for (uint8_t i = 0; i < PS2_NPORTS; i++) {
+        drain_port(&ports[i]);
+    }
+    return false;
+}
+
+static void port_0_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    byte_ring_put_stamped(&ports[PORT0].ring, read_byte(PORT_DATA), read_tsc());
+    idle_wake();
+}
+
+static void port_1_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    byte_ring_put_stamped(&ports[PORT1].ring, read_byte(PORT_DATA), read_tsc());
+    idle_wake();
+}
+
+bool ps2_queue_command(port_t port, const ps2_command_t *cmd) {
+    ps2_port_t *p = &ports[port];
+    if (p->qlen >= PS2_QUEUE_SIZE) {
+        return false;
     }
+
+    ps2_command_t *slot = &p->queue[(p->qhead + p->qlen) % PS2_QUEUE_SIZE];
+    *slot = *cmd;
+    if (!slot->timeout_ms) {
+        slot->timeout_ms = PS2_CMD_TIMEOUT_MS;
+    }
+    if (slot->max_resp > PS2_MAX_RESPONSE) {
+        slot->max_resp = PS2_MAX_RESPONSE;
+    }
+    p->qlen++;
+
+    start_next(p);
+    return true;
+}
+
+void ps2_set_receiver(port_t port, ps2_receiver_t receiver) {
+    ports[port].receiver = receiver;
+}
+
+uint32_t ps2_get_dropped(port_t port) {
+    return byte_ring_get_dropped(&ports[port].ring);
 }
 
 static config_resp_t ps2_get_config() {
@@ -380,96 +631,108 @@ static void print_port_error_msg(uint8_t status) {
     }
 }
 
-static void reset_port(uint16_t *device_id, port_t port) {
-    // The response from a reset device command is not necessarily ACK, so we
-    // don't use the standard ps2_send_device_command() function.
-
-    // ps2_send_device_command(CMD_RESET_DEVICE, port);
-    if (port == PORT1) {
-        ps2_send_command(CMD_WRITE_INPUT_PORT_1);
-    }
-    ps2_send_data(CMD_RESET_DEVICE);
+void ps2_init_device(uint16_t device_id, port_t port) {
+    device_type_t type = get_device_type(device_id);
+    uint8_t portno = port ? 1 : 0;
 
-    const uint8_t NRESP = 3;
-    uint8_t resp[NRESP];
-    for (uint8_t i = 0; i < NRESP; i++) {
-        bool has_byte = try_read_data(&resp[i]);
-        if (!has_byte) {
-            *device_id = 0;
-            println("Port %d is not populated", port);
-            return;
-        }
+    if (type == DEV_UNKNOWN) {
+        println("Failed to initialise ps2 device in port %d: Unknown device (ID: %#x)", portno, device_id);
+        return;
+    } else {
+        println("Port %d successfully initialised. Device type: %s", portno, get_device_type_str(type));
     }
 
-    if (resp[0] == RESP_RESET_FAIL) {
-        println("Port %d reset failed", port);
-        return;
+    // Invoke the appropriate driver.
+    device_kind_t kind = get_device_kind(type);
+    if (kind == KEYBOARD) {
+        ps2_kbd_init(port);
+    } else if (kind == MOUSE) {
+        ps2_mouse_init(port);
     }
+}
 
-    // The order in which devices send these two seems to be ambiguous.
-    if ( (resp[0] == RESP_ACK && resp[1] == RESP_RESET_SUCCESS) ||
-         (resp[0] == RESP_RESET_SUCCESS && resp[1] == RESP_ACK) ) {
+static void set_device_id(port_t port, uint16_t device_id) {
+    if (port == PORT0) {
+        port0_id = device_id;
     } else {
-        uint16_t response = ( (resp[0] << 8) + resp[1]);
-        println("Failed to reset port %d; resp = %x", port, response);
+        port1_id = device_id;
     }
+}
 
-    *device_id = resp[2];
-
-    // The device ID response byte seems buggy. Here we use an explicit
-    // identify command to to retrieve the correct device ID.
+static void identify_done(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)data;
+    uint8_t portno = port ? 1 : 0;
 
-    uint8_t special_code = 0;
-    if (resp[2] == 0xab || resp[2] == 0xac) {
-        bool has_special_code = try_read_data(&special_code);
-        if (has_special_code) {
-            *device_id = *device_id + (special_code << 8);
-        }
+    if (status != PS2_CMD_OK) {
+        println("Failed to identify device in port %d", portno);
+        return;
     }
 
-    // Send the disable scanning command to the device.
-    ps2_send_device_command(CMD_DISABLE_SCAN, port);
-
-    // Send the identify command to the device.
-    ps2_send_device_command(CMD_IDENTIFY, port);
-
-    // Wait for the device to send up to 2 bytes of reply.
-    uint8_t response;
-    if (try_read_data(&response)) {
-        *device_id = response;
-
-        if (try_read_data(&response)) {
-            *device_id = (*device_id << 8) + response;
-        }
+    // Ancient AT keyboards send no ID at all.
+    uint16_t device_id = nresp ? 0 : ID_AT_KEYBOARD;
+    for (uint8_t i = 0; i < nresp; i++) {
+        device_id = (device_id << 8) + resp[i];
     }
+    set_device_id(port, device_id);
 
-    // Send the Enable Scanning command to the device.
-    ps2_send_device_command(CMD_ENABLE_SCAN, port);
+    ps2_init_device(device_id, port);
 }
 
-void ps2_init_device(uint16_t device_id, port_t port) {
-    device_type_t type = get_device_type(device_id);
+static void reset_done(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)data;
     uint8_t portno = port ? 1 : 0;
 
-    if (type == DEV_UNKNOWN) {
-        println("Failed to initialise ps2 device in port %d: Unknown device (ID: %x)", port == PORT0 ? 0 : 1, port0_id);
+    if (status == PS2_CMD_TIMEOUT && nresp == 0) {
+        println("Port %d is not populated", portno);
         return;
-    } else {
-        println("Port %d successfully initialised. Device type: %s", portno, get_device_type_str(type));
     }
-
-    // Invoke the appropriate driver.
-    device_kind_t kind = get_device_kind(type);
-    if (kind == KEYBOARD) {
-        ps2_kbd_init(port);
-    } else if (kind == MOUSE) {
-        // ps2_mouse_init(port);
+    if (status != PS2_CMD_OK || resp[0] != RESP_RESET_SUCCESS) {
+        println("Port %d reset failed", portno);
+        return;
     }
+
+    // The device ID sent after a reset is unreliable, so ask for it
+    // explicitly, with scanning disabled so that it isn't mixed up with other
+    // data. The device's driver enables scanning again.
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_DISABLE_SCAN });
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_IDENTIFY, .max_resp = 2, .done = identify_done });
+}
+
+/*
+Reset the device in a port, and start its driver once it's been identified.
+This happens in the background, so devices in both ports are probed at the
+same time, and an empty port doesn't hold up anything else.
+*/
+static void probe_port(port_t port) {
+    // The response is 0xFA, 0xAA (in either order) followed by up to two
+    // bytes of device ID, or 0xFC if the device's self-test failed. If
+    // there's no response at all, the port isn't populated.
+    ps2_queue_command(port, &(ps2_command_t){
+        .cmd = CMD_RESET_DEVICE,
+        .min_resp = 1,
+        .max_resp = 3,
+        .timeout_ms = PS2_RESET_TIMEOUT_MS,
+        .done = reset_done
+    });
+}
+
+static void init_port_state(port_t port) {
+    ps2_port_t *p = &ports[port];
+    p->port = port;
+    byte_ring_init_stamped(&p->ring, p->ring_buf, p->ring_stamps, PS2_RING_SIZE);
+    p->qhead = 0;
+    p->qlen = 0;
+    p->busy = false;
+    p->receiver = 0;
+    timer_init(&p->timer, command_timeout, p);
 }
 
 void ps2_init() {
     // todo: Disable USB legacy support
 
+    init_port_state(PORT0);
+    init_port_state(PORT1);
+
     // Disable devices to avoid them sending data partway through initialisation
     // of the controller.
     ps2_send_command(CMD_DISABLE_PORT_0);
@@ -485,7 +748,7 @@ void ps2_init() {
 
     // Disable IRQs and translation for port 1 by clearing bits 0 and 6. Also
     // ensure the clock signal is enabled by clearing bit 4.
-    config.config.port_0_interrupt = true;
+    config.config.port_0_interrupt = false;
     config.config.port_0_translation = false;
     config.config.clock_0 = false;
 
@@ -567,7 +830,19 @@ void ps2_init() {
         ps2_send_command(CMD_ENABLE_PORT_1);
     }
 
-    // If using interrupts, enable interrupts on all functional ports.
+    // From here on, bytes from the devices are received by IRQ handlers, and
+    // processed by ps2_poll() from the idle loop.
+    idle_add_poll(ps2_poll);
+    if (port_0_operational) {
+        idt_install_irq_handler(pic_get_vector(PS2_IRQ_PORT0), port_0_irq_handler);
+        irq_clear_mask(PS2_IRQ_PORT0);
+    }
+    if (port_1_operational) {
+        idt_install_irq_handler(pic_get_vector(PS2_IRQ_PORT1), port_1_irq_handler);
+        irq_clear_mask(PS2_IRQ_PORT1);
+    }
+
+    // Enable interrupts on all functional ports.
     config = ps2_get_config();
     if (port_0_operational) {
         config.config.port_0_interrupt = true;
@@ -577,25 +852,14 @@ void ps2_init() {
     }
     ps2_set_config(config);
 
-    // All devices should be reset by sending 0xFF to port 1 (and port 2 for
-    // dual channel controllers) and waiting for a response. If the response is
-    // 0xFA, 0xAA (Note: the order in which devices send these two seems to be
-    // ambiguous) followed by the device PS/2 ID, then the device reset was
-    // successful. If the response is 0xFC then the self test failed and the
-    // device should be ignored. If there's no response at all then the port is
-    // not populated. 
-
+    // Reset and identify the devices in the background. Devices which reset
+    // successfully are handed to their drivers by ps2_init_device().
+    port0_id = 0;
+    port1_id = 0;
     if (port_0_operational) {
-        reset_port(&port0_id, PORT0);
-        ps2_init_device(port0_id, PORT0);
-    } else {
-        port0_id = 0;
+        probe_port(PORT0);
     }
-
     if (port_1_operational) {
-        reset_port(&port1_id, PORT1);
-        ps2_init_device(port1_id, PORT1);
-    } else {
-        port1_id = 0;
+        probe_port(PORT1);
     }
 }
@@ -10,31 +10,114 @@ typedef enum {
     PORT1
 } port_t;
 
+// Maximum number of response bytes to a device command, not counting ACKs.
+#define PS2_MAX_RESPONSE 4
+
+// Outcome of a device command.
+typedef enum {
+    // The command was acknowledged, and at least the minimum number of
+    // response bytes arrived.
+    PS2_CMD_OK,
+    // The device didn't respond in time.
+    PS2_CMD_TIMEOUT,
+    // The device asked for the command to be resent too many times.
+    PS2_CMD_ERROR
+} ps2_cmd_status_t;
+
+/*
+A function called when a device command completes. This is called from the
+idle loop, never from interrupt context, and may queue more commands.
+
+@param port: The port of the device.
+@param status: Outcome of the command.
+@param resp: The response bytes received, not counting ACKs.
+@param nresp: The number of response bytes.
+@param data: The data pointer given with the command.
+*/
+typedef void (*ps2_cmd_done_t)(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data);
+
+/*
+A function which receives every byte sent by a device while no command is in
+progress, eg scan codes. This is called from the idle loop, never from
+interrupt context.
+
+@param port: The port of the device.
+@param byte: The byte.
+@param timestamp: Value of the TSC when the byte's interrupt arrived.
+*/
+typedef void (*ps2_receiver_t)(port_t port, uint8_t byte, uint64_t timestamp);
+
+// A command to a PS/2 device.
+typedef struct {
+    uint8_t cmd;
+
+    // Data byte sent once the command has been acknowledged, if has_arg is
+    // set. It's acknowledged in turn.
+    bool has_arg;
+    uint8_t arg;
+
+    // Number of response bytes which follow the ACK. If the device sends a
+    // variable number, the command completes when max_resp have arrived, or
+    // shortly after min_resp have arrived.
+    uint8_t min_resp;
+    uint8_t max_resp;
+
+    // Time allowed for the whole command, or 0 for the default.
+    uint32_t timeout_ms;
+
+    // Function called on completion, or 0.
+    ps2_cmd_done_t done;
+    void *data;
+} ps2_command_t;
+
 /*
 Initialise the PS/2 controller. This should only be called if a PS/2 controller
 exists (see ps2_controller_exists()).
+
+The devices are probed in the background: this returns once the controller has
+been tested, and each device's driver is started from the idle loop once the
+device has been reset and identified. This must be called after idle_init().
 */
 void ps2_init();
 
 /*
-Send a command to the controller.
+Queue a command for the device in a port. Commands to each port are sent one at
+a time, in order, and complete when the device responds, or when their deadline
+passes. Return false if too many commands are already queued.
 
-@param command: The command.
+@param port: The port.
+@param cmd: The command. This is copied.
 */
-void ps2_send_command(uint8_t command);
+bool ps2_queue_command(port_t port, const ps2_command_t *cmd);
 
+/*
+Set the function which receives bytes sent by the device in a port outside of
+any command.
+
+@param port: The port.
+@param receiver: The function, or 0 to discard such bytes.
+*/
+void ps2_set_receiver(port_t port, ps2_receiver_t receiver);
 
 /*
-Send a command a ps2 device, and wait for ACK.
+Get the number of bytes from the device in a port which were dropped because
+they weren't processed quickly enough.
 
-@param cmd: The command.
 @param port: The port.
 */
-void ps2_send_device_command(uint8_t cmd, port_t port);
+uint32_t ps2_get_dropped(port_t port);
+
+/*
+Send a command to the controller.
+
+@param command: The command.
+*/
+void ps2_send_command(uint8_t command);
+
 
 /*
 Wait until the controller is ready for a command. Return true when the
-controller is ready, or false if wait iterations elapse.
+controller is ready, or false if it doesn't become ready in time.
 */
 bool ps2_buffer_wait();
 
@@ -3,14 +3,11 @@
 
 #include "ps2_keyboard.h"
 #include "vga.h"
-#include "idt.h"
-#include "pic.h"
+#include "input.h"
+#include "klog.h"
 
 // Commands
 
-// IRQ1
-#define PS2_KBD_IRQ 0x01
-
 #define CMD_KEY_SET_LED 0xed
 #define CMD_KEY_ECHO 0xee
 
@@ -79,19 +76,80 @@ typedef enum {
 // Resend (keyboard wants controller to repeat last command it sent).
 #define RESP_RESEND 0xfe
 
-static uint8_t _vector = 0;
+// Modifier keys which are held, and locks which are on.
+#define KEY_MOD_SHIFT 0x01
+#define KEY_MOD_CTRL 0x02
+#define KEY_MOD_ALT 0x04
+#define KEY_MOD_CAPS_LOCK 0x08
+#define KEY_MOD_NUM_LOCK 0x10
+#define KEY_MOD_SCROLL_LOCK 0x20
+
+// Scan code set 1 prefixes.
+#define SC_EXTENDED 0xe0
+#define SC_PAUSE 0xe1
+
+// Bit set in the code of a key release (break code).
+#define SC_BREAK 0x80
+
+// Number of bytes following the 0xE1 prefix of the pause key.
+#define SC_PAUSE_LEN 2
+
+// Make codes of the modifier and lock keys.
+#define SC_LCTRL 0x1d
+#define SC_LSHIFT 0x2a
+#define SC_RSHIFT 0x36
+#define SC_LALT 0x38
+#define SC_CAPS_LOCK 0x3a
+#define SC_NUM_LOCK 0x45
+#define SC_SCROLL_LOCK 0x46
+#define SC_RCTRL (KEY_EXTENDED | SC_LCTRL)
+#define SC_RALT (KEY_EXTENDED | SC_LALT)
+
+// The range of make codes of the numeric keypad, which type digits when num
+// lock is on.
+#define SC_KEYPAD_FIRST 0x47
+#define SC_KEYPAD_LAST 0x53
+
+// Bits of held, for modifier and lock keys which are held down.
+#define HELD_LSHIFT 0x001
+#define HELD_RSHIFT 0x002
+#define HELD_LCTRL 0x004
+#define HELD_RCTRL 0x008
+#define HELD_LALT 0x010
+#define HELD_RALT 0x020
+#define HELD_CAPS_LOCK 0x040
+#define HELD_NUM_LOCK 0x080
+#define HELD_SCROLL_LOCK 0x100
+
+static bool initialised = false;
 static uint8_t _port = 0;
 
-// The interrupt vector used by the controller.
-// static uint8_t interrupt_vector = 0x00;
-
-/*
-Get the interrupt vector corresponding to IRQ1. For now, we use 0x21.
-*/
-uint8_t get_vector() {
-    // TODO: ask the PIC in case we've done some remapping?
-    return pic_get_vector(PS2_KBD_IRQ);
-}
+// Decoder state. This is only touched outside interrupt context.
+static bool extended = false;
+static uint8_t pause_bytes = 0;
+static uint16_t held = 0;
+static uint8_t locks = 0;
+
+// Characters typed by the keys of the main block, by make code, in the US
+// layout.
+static const char keymap[] = {
+    0, 0x1b, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0, ' '
+};
+
+static const char keymap_shift[] = {
+    0, 0x1b, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+    0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+    '*', 0, ' '
+};
+
+// Characters typed by the keypad, from SC_KEYPAD_FIRST.
+static const char keymap_keypad[] = "789-456+1230.";
 
 // static bool is_responsive() {
 //     write_byte(PORT_PS2_DATA, CMD_KEY_ECHO);
@@ -99,8 +157,179 @@ uint8_t get_vector() {
 //     return resp == RESP_ECHO;
 // }
 
-void ps2_kbd_irq_handler() {
-    println("ps2_kbd: Keyboard interrupt received");
+/*
+Get the bit of held for a modifier or lock key, or 0 for any other key.
+*/
+static uint16_t get_held_bit(uint8_t keycode) {
+    switch (keycode) {
+        case SC_LSHIFT:
+            return HELD_LSHIFT;
+        case SC_RSHIFT:
+            return HELD_RSHIFT;
+        case SC_LCTRL:
+            return HELD_LCTRL;
+        case SC_RCTRL:
+            return HELD_RCTRL;
+        case SC_LALT:
+            return HELD_LALT;
+        case SC_RALT:
+            return HELD_RALT;
+        case SC_CAPS_LOCK:
+            return HELD_CAPS_LOCK;
+        case SC_NUM_LOCK:
+            return HELD_NUM_LOCK;
+        case SC_SCROLL_LOCK:
+            return HELD_SCROLL_LOCK;
+        default:
+            return 0;
+    }
+}
+
+/*
+Track which modifier keys are held, and toggle locks when their keys are first
+pressed (but not when they repeat).
+*/
+static void update_modifiers(uint8_t keycode, bool pressed) {
+    uint16_t bit = get_held_bit(keycode);
+    if (!bit) {
+        return;
+    }
+
+    if (!pressed) {
+        held &= ~bit;
+        return;
+    }
+
+    if (!(held & bit)) {
+        if (bit == HELD_CAPS_LOCK) {
+            locks ^= KEY_MOD_CAPS_LOCK;
+        } else if (bit == HELD_NUM_LOCK) {
+            locks ^= KEY_MOD_NUM_LOCK;
+        } else if (bit == HELD_SCROLL_LOCK) {
+            locks ^= KEY_MOD_SCROLL_LOCK;
+        }
+    }
+    held |= bit;
+}
+
+static uint8_t get_modifiers() {
+    uint8_t modifiers = locks;
+    if (held & (HELD_LSHIFT | HELD_RSHIFT)) {
+        modifiers |= KEY_MOD_SHIFT;
+    }
+    if (held & (HELD_LCTRL | HELD_RCTRL)) {
+        modifiers |= KEY_MOD_CTRL;
+    }
+    if (held & (HELD_LALT | HELD_RALT)) {
+        modifiers |= KEY_MOD_ALT;
+    }
+    return modifiers;
+}
+
+/*
+Get the character typed by a key, or 0 if it doesn't type one.
+*/
+static char to_ascii(uint8_t keycode, uint8_t modifiers) {
+    // Of the extended keys, only those on the keypad type anything.
+    if (keycode == (KEY_EXTENDED | 0x1c)) {
+        return '\n';
+    }
+    if (keycode == (KEY_EXTENDED | 0x35)) {
+        return '/';
+    }
+    if (keycode & KEY_EXTENDED) {
+        return 0;
+    }
+
+    if (keycode >= SC_KEYPAD_FIRST && keycode <= SC_KEYPAD_LAST) {
+        char c = keymap_keypad[keycode - SC_KEYPAD_FIRST];
+        bool digit = c != '-' && c != '+';
+        return !digit || (modifiers & KEY_MOD_NUM_LOCK) ? c : 0;
+    }
+
+    if (keycode >= sizeof(keymap)) {
+        return 0;
+    }
+
+    // Caps lock only affects letters, and is undone by shift.
+    bool shift = modifiers & KEY_MOD_SHIFT;
+    char c = keymap[keycode];
+    if (c >= 'a' && c <= 'z' && (modifiers & KEY_MOD_CAPS_LOCK)) {
+        shift = !shift;
+    }
+    if (shift) {
+        c = keymap_shift[keycode];
+    }
+
+    // Ctrl turns letters into control characters, eg Ctrl+C is 0x03.
+    if ((modifiers & KEY_MOD_CTRL) && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c &= 0x1f;
+    }
+    return c;
+}
+
+/*
+Report a key being pressed or released, and the character it types, if any.
+*/
+static void report_key(uint8_t keycode, bool pressed, uint64_t timestamp) {
+    update_modifiers(keycode, pressed);
+
+    input_report(timestamp, INPUT_KEY, keycode, pressed);
+    if (pressed) {
+        char c = to_ascii(keycode, get_modifiers());
+        if (c) {
+            input_report(timestamp, INPUT_CHAR, keycode, c);
+        }
+    }
+    input_sync(timestamp);
+}
+
+/*
+Decode a byte sent by the keyboard, and report the key event it completes, if
+any. Called by the PS/2 driver, from the idle loop.
+*/
+static void kbd_receive(port_t port, uint8_t byte, uint64_t timestamp) {
+    (void)port;
+
+    if (pause_bytes) {
+        // Pause sends 0xE1 0x1D 0x45 when pressed, and then immediately
+        // 0xE1 0x9D 0xC5, as if it were released.
+        if (!--pause_bytes) {
+            report_key(KEY_PAUSE, !(byte & SC_BREAK), timestamp);
+        }
+        return;
+    }
+
+    switch (byte) {
+        case SC_EXTENDED:
+            extended = true;
+            return;
+        case SC_PAUSE:
+            pause_bytes = SC_PAUSE_LEN;
+            return;
+        case RESP_INTERNAL_ERROR:
+        case RESP_ACK:
+        case RESP_RESEND:
+        case 0xff:
+            // Responses to commands and errors aren't keys.
+            extended = false;
+            return;
+    }
+
+    bool pressed = !(byte & SC_BREAK);
+    uint8_t keycode = byte & ~SC_BREAK;
+    if (extended) {
+        extended = false;
+
+        // Some extended keys are surrounded by fake shift presses and
+        // releases, eg print screen is 0xE0 0x2A 0xE0 0x37.
+        if (keycode == SC_LSHIFT || keycode == SC_RSHIFT) {
+            return;
+        }
+        keycode |= KEY_EXTENDED;
+    }
+
+    report_key(keycode, pressed, timestamp);
 }
 
 static uint8_t get_scan_code_set_id(scan_code_set_t set) {
@@ -127,60 +356,67 @@ static scan_code_set_t get_scan_code_set(uint8_t id) {
     }
 }
 
-static void ps2_kbd_send_cmd(uint8_t cmd) {
-    ps2_send_device_command(cmd, _port);
-}
+static void scan_code_set_checked(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)port;
+    (void)data;
+    if (status != PS2_CMD_OK || nresp < 1) {
+        klog(LOG_WARN, "ps2_kbd: failed to read scan code set");
+        return;
+    }
 
-static scan_code_set_t ps2_kbd_get_scan_code() {
-    ps2_kbd_send_cmd(CMD_GET_SCAN_CODE);
-    uint8_t id = ps2_read_data();
-    return get_scan_code_set(id);
+    // The decoder only understands set 1.
+    scan_code_set_t set = get_scan_code_set(resp[0]);
+    if (set != SET_1) {
+        klog(LOG_WARN, "ps2_kbd: keyboard uses scan code set %d, but set %d was requested", get_scan_code_set_id(set), SCAN_CODE_SET_1);
+    }
 }
 
-static void ps2_kbd_set_scan_codes(scan_code_set_t set) {
-    uint8_t set_id = get_scan_code_set_id(set);
-    ps2_kbd_send_cmd(CMD_SET_SCAN_CODE);
-    ps2_send_data(set_id);
-
-    // Check the scan code set.
-    scan_code_set_t new_set = ps2_kbd_get_scan_code();
-    if (new_set != set) {
-        println("ps2_kbd_get_scan_code() gives scan code %d but expected %d...", get_scan_code_set_id(new_set), set_id);
-        ps2_kbd_set_scan_codes(set);
+static void scanning_enabled(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)resp;
+    (void)nresp;
+    (void)data;
+    uint16_t portno = port ? 1 : 0;
+    if (status == PS2_CMD_OK) {
+        println("PS/2 keyboard in port %d is ready", portno);
+    } else {
+        println("Failed to enable scanning on PS/2 keyboard in port %d", portno);
     }
 }
 
 void ps2_kbd_init(port_t port) {
     // Ensure driver is not already initialised.
-    if (_vector) return;
+    if (initialised) return;
+    initialised = true;
 
     _port = port;
-    _vector = get_vector();
 
-    // Install IRQ handler.
+    extended = false;
+    pause_bytes = 0;
+    held = 0;
+    locks = 0;
+
     uint16_t portno = port ? 1 : 0;
     println("Initialising PS/2 keyboard in port %d...", portno);
 
-    // Unmask IRQ1.
-    println("Unmasking IRQ1...");
-    irq_clear_mask(0x01);
-
-    // Enable scanning.
-    println("Enabling scanning...");
-    ps2_kbd_send_cmd(CMD_KEY_ENABLE_SCAN);
-
-    // Set scan codes.
-    // ps2_kbd_set_scancodes(SCANCODE_SET_2);
-    println("Enabling scan code 1...");
-    ps2_kbd_set_scan_codes(SET_1);
-    // ps2_kbd_reset_state();
-
-
-    // Install interrupt handler.
-    println("Installing IRQ handler...");
-    idt_install_irq_handler(_vector, ps2_kbd_irq_handler);
-
-    println("Triggerring interrupt 0x21...");
-    asm volatile("int $0x21");
-    println("Successfully triggered interrupt 0x21!");
+    ps2_set_receiver(port, kbd_receive);
+
+    // These complete in the background. Switch to scan code set 1 and check
+    // that the keyboard supports it, then enable scanning.
+    ps2_queue_command(port, &(ps2_command_t){
+        .cmd = CMD_SET_SCAN_CODE,
+        .has_arg = true,
+        .arg = SCAN_CODE_SET_1
+    });
+    ps2_queue_command(port, &(ps2_command_t){
+        .cmd = CMD_GET_SCAN_CODE,
+        .has_arg = true,
+        .arg = 0,
+        .min_resp = 1,
+        .max_resp = 1,
+        .done = scan_code_set_checked
+    });
+    ps2_queue_command(port, &(ps2_command_t){
+        .cmd = CMD_KEY_ENABLE_SCAN,
+        .done = scanning_enabled
+    });
 }
@@ -1,10 +1,23 @@
 #ifndef _DREWOS_PS2_KEYBOARD_H_
 #define _DREWOS_PS2_KEYBOARD_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "ps2.h"
 
+// Keys are reported to the input layer as INPUT_KEY events, with their make
+// code in scan code set 1 as the code. Keys whose codes have an 0xE0 prefix
+// have the code after the prefix, with this bit set.
+#define KEY_EXTENDED 0x80
+
+// Pause has a sequence of its own (0xE1 0x1D 0x45), and is given this code.
+#define KEY_PAUSE (KEY_EXTENDED | 0x45)
+
 /*
-Initialise the PS/2 keyboard driver for the device in the specified port.
+Initialise the PS/2 keyboard driver for the device in the specified port. Key
+presses and releases are reported to the input layer, followed by an INPUT_CHAR
+event for keys which type a character in the US layout.
 */
 void ps2_kbd_init(port_t port);
 
@@ -0,0 +1,283 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ps2_mouse.h"
+#include "input.h"
+#include "clock.h"
+#include "vga.h"
+
+// Commands
+
+// Set the resolution. Data byte: 0-3 for 1, 2, 4 or 8 counts/mm.
+#define CMD_MOUSE_SET_RESOLUTION 0xe8
+
+// Get the device ID. Response: ACK, then the ID.
+#define CMD_MOUSE_GET_ID 0xf2
+
+// Set the sample rate. Data byte: samples per second.
+#define CMD_MOUSE_SET_SAMPLE_RATE 0xf3
+
+#define CMD_MOUSE_ENABLE_REPORTING 0xf4
+
+// Device IDs.
+#define ID_STANDARD 0x00
+#define ID_INTELLIMOUSE 0x03
+#define ID_INTELLIMOUSE_5BUTTON 0x04
+
+#define RESOLUTION_8_PER_MM 0x03
+
+#define SAMPLE_RATE 200
+
+// Number of decoded events which can wait to be read.
+#define MOUSE_EVENT_QUEUE_SIZE 32
+
+// Bits of the first byte of a packet.
+#define PACKET_BUTTONS 0x07
+#define PACKET_ALWAYS_1 0x08
+#define PACKET_X_SIGN 0x10
+#define PACKET_Y_SIGN 0x20
+#define PACKET_X_OVERFLOW 0x40
+#define PACKET_Y_OVERFLOW 0x80
+
+// Bits of the fourth byte of a 5-button packet.
+#define PACKET_Z_MASK 0x0f
+#define PACKET_Z_SIGN 0x08
+#define PACKET_BUTTON_4 0x10
+#define PACKET_BUTTON_5 0x20
+
+#define MAX_PACKET_SIZE 4
+
+// A packet's bytes are sent back to back, so they're never further apart than
+// packets are at the sample rate. A longer gap means the next byte starts a
+// packet.
+#define MAX_BYTE_GAP_NS (1000000000 / SAMPLE_RATE)
+
+static bool initialised = false;
+
+// Device ID after negotiation, which determines the packet format.
+static uint8_t device_id = ID_STANDARD;
+static uint8_t packet_size = 3;
+
+// The packet being assembled.
+static uint8_t packet[MAX_PACKET_SIZE];
+static uint8_t packet_len = 0;
+static uint64_t packet_stamp = 0;
+
+// Value of ps2_get_dropped() when the packet was started. If bytes have been
+// dropped since, the rest of the packet is misaligned.
+static uint32_t dropped = 0;
+
+static uint32_t bad_packets = 0;
+
+// Buttons held, as of the last packet, as INPUT_BTN_* bits from INPUT_BTN_LEFT.
+static uint8_t buttons = 0;
+
+// Number of mouse buttons reported by each protocol.
+#define MAX_BUTTONS 5
+
+// The knock sequences which unlock the IntelliMouse protocols: setting these
+// sample rates in turn makes the mouse report a different ID.
+static const uint8_t knock_wheel[] = { 200, 100, 80 };
+static const uint8_t knock_5button[] = { 200, 200, 80 };
+
+/*
+Decode a complete packet, and report its events. Return false if the packet
+is bad, in which case nothing is reported.
+*/
+static bool decode_packet() {
+    // The deltas are 9-bit two's complement, with the sign bit in the first
+    // byte. They're meaningless if they overflowed, and the overflow bits are
+    // also often set in a byte which was mistaken for the first one.
+    if (packet[0] & (PACKET_X_OVERFLOW | PACKET_Y_OVERFLOW)) {
+        bad_packets++;
+        return false;
+    }
+
+    // The timestamp is that of the packet's last byte.
+    uint64_t timestamp = packet_stamp;
+    int16_t dx = packet[1] - ((packet[0] & PACKET_X_SIGN) ? 0x100 : 0);
+    int16_t dy = -(packet[2] - ((packet[0] & PACKET_Y_SIGN) ? 0x100 : 0));
+    int8_t dz = 0;
+    uint8_t held = packet[0] & PACKET_BUTTONS;
+
+    if (device_id == ID_INTELLIMOUSE) {
+        dz = (int8_t)packet[3];
+    } else if (device_id == ID_INTELLIMOUSE_5BUTTON) {
+        // The wheel movement is 4-bit two's complement.
+        uint8_t z = packet[3] & PACKET_Z_MASK;
+        dz = (z & PACKET_Z_SIGN) ? (int8_t)(z | ~PACKET_Z_MASK) : (int8_t)z;
+        if (packet[3] & PACKET_BUTTON_4) {
+            held |= 1 << (INPUT_BTN_4 - INPUT_BTN_LEFT);
+        }
+        if (packet[3] & PACKET_BUTTON_5) {
+            held |= 1 << (INPUT_BTN_5 - INPUT_BTN_LEFT);
+        }
+    }
+
+    // Report the buttons which changed, then the movement. The input layer
+    // merges consecutive groups of movement which haven't been read yet.
+    uint8_t changed = held ^ buttons;
+    for (uint8_t i = 0; i < MAX_BUTTONS; i++) {
+        if (changed & (1 << i)) {
+            input_report(timestamp, INPUT_KEY, INPUT_BTN_LEFT + i, (held >> i) & 1);
+        }
+    }
+    buttons = held;
+
+    if (dx) {
+        input_report(timestamp, INPUT_REL, INPUT_REL_X, dx);
+    }
+    if (dy) {
+        input_report(timestamp, INPUT_REL, INPUT_REL_Y, dy);
+    }
+    if (dz) {
+        input_report(timestamp, INPUT_REL, INPUT_REL_WHEEL, dz);
+    }
+    if (changed || dx || dy || dz) {
+        input_sync(timestamp);
+    }
+    return true;
+}
+
+/*
+Discard the first byte of the packet being assembled, which can't have started
+a packet, and keep the rest from the next byte which could have.
+*/
+static void resync() {
+    uint8_t start = 1;
+    while (start < packet_len && !(packet[start] & PACKET_ALWAYS_1)) {
+        start++;
+    }
+    for (uint8_t i = start; i < packet_len; i++) {
+        packet[i - start] = packet[i];
+    }
+    packet_len -= start;
+}
+
+/*
+Add a byte sent by the mouse to the packet being assembled. Called by the PS/2
+driver, from the idle loop.
+*/
+static void mouse_receive(port_t port, uint8_t byte, uint64_t timestamp) {
+    // A dropped byte shifts every later packet, so start again.
+    uint32_t now_dropped = ps2_get_dropped(port);
+    if (now_dropped != dropped) {
+        dropped = now_dropped;
+        if (packet_len) {
+            bad_packets++;
+        }
+        packet_len = 0;
+    }
+
+    // After a pause, the mouse starts with a new packet. If the clock isn't
+    // calibrated yet, tsc_to_ns() returns 0, and only the checks below are
+    // used.
+    if (packet_len && tsc_to_ns(timestamp - packet_stamp) > MAX_BYTE_GAP_NS) {
+        bad_packets++;
+        packet_len = 0;
+    }
+
+    // Bit 3 of the first byte is always set. If it isn't, this must be the
+    // middle of a packet, so skip bytes until it looks like a packet starts.
+    if (packet_len == 0 && !(byte & PACKET_ALWAYS_1)) {
+        bad_packets++;
+        return;
+    }
+
+    packet[packet_len++] = byte;
+    packet_stamp = timestamp;
+    if (packet_len == packet_size) {
+        // A bad packet may have been misaligned, so look for a packet start
+        // within it, rather than assuming the next byte starts one.
+        if (decode_packet()) {
+            packet_len = 0;
+        } else {
+            resync();
+        }
+    }
+}
+
+static void reporting_enabled(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)resp;
+    (void)nresp;
+    (void)data;
+    uint16_t portno = port ? 1 : 0;
+    if (status != PS2_CMD_OK) {
+        println("Failed to enable PS/2 mouse in port %d", portno);
+        return;
+    }
+
+    // Only start assembling packets now, so that replies to the setup
+    // commands can't be mistaken for them.
+    packet_len = 0;
+    dropped = ps2_get_dropped(port);
+    ps2_set_receiver(port, mouse_receive);
+
+    const char *kind = device_id == ID_INTELLIMOUSE_5BUTTON ? "5-button" : device_id == ID_INTELLIMOUSE ? "scroll wheel" : "standard";
+    println("PS/2 mouse in port %d is ready (%s, %d samples/s)", portno, kind, SAMPLE_RATE);
+}
+
+/*
+Set the sample rate and resolution, and enable data reporting.
+*/
+static void start_reporting(port_t port) {
+    packet_size = device_id == ID_STANDARD ? 3 : 4;
+
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_MOUSE_SET_SAMPLE_RATE, .has_arg = true, .arg = SAMPLE_RATE });
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_MOUSE_SET_RESOLUTION, .has_arg = true, .arg = RESOLUTION_8_PER_MM });
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_MOUSE_ENABLE_REPORTING, .done = reporting_enabled });
+}
+
+/*
+Send a knock sequence, then ask for the device ID.
+*/
+static void knock(port_t port, const uint8_t *rates, uint8_t n, ps2_cmd_done_t done) {
+    for (uint8_t i = 0; i < n; i++) {
+        ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_MOUSE_SET_SAMPLE_RATE, .has_arg = true, .arg = rates[i] });
+    }
+    ps2_queue_command(port, &(ps2_command_t){ .cmd = CMD_MOUSE_GET_ID, .min_resp = 1, .max_resp = 1, .done = done });
+}
+
+static void knock_5button_done(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)data;
+    if (status == PS2_CMD_OK && nresp && resp[0] == ID_INTELLIMOUSE_5BUTTON) {
+        device_id = ID_INTELLIMOUSE_5BUTTON;
+    }
+    start_reporting(port);
+}
+
+static void knock_wheel_done(port_t port, ps2_cmd_status_t status, const uint8_t *resp, uint8_t nresp, void *data) {
+    (void)data;
+    if (status != PS2_CMD_OK || !nresp || resp[0] != ID_INTELLIMOUSE) {
+        start_reporting(port);
+        return;
+    }
+
+    // A mouse with a scroll wheel may also have buttons 4 and 5.
+    device_id = ID_INTELLIMOUSE;
+    knock(port, knock_5button, sizeof(knock_5button), knock_5button_done);
+}
+
+void ps2_mouse_init(port_t port) {
+    // Ensure driver is not already initialised.
+    if (initialised) return;
+    initialised = true;
+
+    device_id = ID_STANDARD;
+    packet_size = 3;
+    packet_len = 0;
+    bad_packets = 0;
+    buttons = 0;
+
+    uint16_t portno = port ? 1 : 0;
+    println("Initialising PS/2 mouse in port %d...", portno);
+
+    // The mouse was left with reporting disabled by the PS/2 driver. Bytes
+    // are ignored until it's configured.
+    ps2_set_receiver(port, 0);
+    knock(port, knock_wheel, sizeof(knock_wheel), knock_wheel_done);
+}
+
+uint32_t ps2_mouse_get_bad_packets() {
+    return bad_packets;
+}
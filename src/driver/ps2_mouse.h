@@ -0,0 +1,26 @@
+#ifndef _DREWOS_PS2_MOUSE_H_
+#define _DREWOS_PS2_MOUSE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ps2.h"
+
+/*
+Initialise the PS/2 mouse driver for the device in the specified port. The
+mouse is switched to the best protocol it supports, and to 200 samples per
+second, in the background. Buttons are reported to the input layer as
+INPUT_KEY events with codes INPUT_BTN_*, and movement as INPUT_REL events, in
+one group per packet.
+
+@param port: The port.
+*/
+void ps2_mouse_init(port_t port);
+
+/*
+Get the number of packets discarded because they were malformed, or because the
+mouse overflowed.
+*/
+uint32_t ps2_mouse_get_bad_packets();
+
+#endif // _DREWOS_PS2_MOUSE_H_
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "serial.h"
+#include "idt.h"
+#include "pic.h"
+#include "low_level.h"
+
+// Driver for a 16550 UART on COM1.
+
+// I/O port base of COM1.
+#define COM1 0x3f8
+
+// IRQ raised by COM1.
+#define SERIAL_IRQ 4
+
+// Registers (offsets from the port base).
+
+// Receive buffer (read) / transmit holding register (write). Low byte of the
+// baud rate divisor when DLAB is set.
+#define REG_DATA 0
+
+// Interrupt enable register. High byte of the baud rate divisor when DLAB is
+// set.
+#define REG_IER 1
+
+// Interrupt identification register (read) / FIFO control register (write).
+#define REG_IIR 2
+#define REG_FCR 2
+
+#define REG_LCR 3
+#define REG_MCR 4
+#define REG_LSR 5
+#define REG_MSR 6
+
+// Interrupt enable bits.
+
+// Received data available.
+#define IER_RDA 0x01
+
+// Transmitter holding register empty.
+#define IER_THRE 0x02
+
+// Interrupt identification.
+
+// Set when no interrupt is pending.
+#define IIR_NO_INT 0x01
+
+// Mask for the interrupt ID.
+#define IIR_ID_MASK 0x0e
+
+#define IIR_MODEM_STATUS 0x00
+#define IIR_THRE 0x02
+#define IIR_RX_DATA 0x04
+#define IIR_LINE_STATUS 0x06
+#define IIR_RX_TIMEOUT 0x0c
+
+// Enable the FIFOs, clear them, and raise the receive interrupt when 14 bytes
+// have been received.
+#define FCR_ENABLE_FIFO 0xc7
+
+// Line control: 8 data bits, no parity, 1 stop bit.
+#define LCR_8N1 0x03
+
+// Divisor latch access bit. While set, REG_DATA and REG_IER hold the divisor.
+#define LCR_DLAB 0x80
+
+// Modem control: DTR, RTS and OUT2. OUT2 gates the UART's IRQ line.
+#define MCR_NORMAL 0x0b
+
+// Modem control: loopback mode, used to check that the UART works.
+#define MCR_LOOPBACK 0x1e
+
+// Line status: the transmitter holding register (or FIFO) is empty.
+#define LSR_THRE 0x20
+
+// Size of the transmit FIFO in a 16550A.
+#define TX_FIFO_SIZE 16
+
+// Size of the transmit ring buffer. Must be a power of 2.
+#define TX_RING_SIZE 4096
+#define TX_RING_MASK (TX_RING_SIZE - 1)
+
+// Transmit ring buffer. Characters are added at tx_head and removed from
+// tx_tail. Both indices increase freely and are masked on every access, so the
+// number of queued characters is always tx_head - tx_tail.
+//
+// tx_head is only written by producers and tx_tail only by the interrupt
+// handler, so neither side ever waits for the other.
+static char tx_ring[TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+// Current value of the interrupt enable register.
+static volatile uint8_t ier = 0;
+
+static bool initialised = false;
+static uint32_t dropped = 0;
+
+static void set_ier(uint8_t value) {
+    ier = value;
+    write_byte(COM1 + REG_IER, value);
+}
+
+/*
+Move up to one FIFO's worth of characters from the ring buffer to the UART.
+Return true if the ring buffer is now empty. The caller must have checked that
+the transmitter is empty.
+*/
+static bool fill_fifo() {
+    uint32_t tail = tx_tail;
+    uint32_t head = tx_head;
+    for (uint8_t i = 0; i < TX_FIFO_SIZE && tail != head; i++) {
+        write_byte(COM1 + REG_DATA, tx_ring[tail++ & TX_RING_MASK]);
+    }
+    tx_tail = tail;
+    return tail == head;
+}
+
+static void serial_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+
+    uint8_t iir;
+    while ( !((iir = read_byte(COM1 + REG_IIR)) & IIR_NO_INT) ) {
+        switch (iir & IIR_ID_MASK) {
+            case IIR_THRE:
+                // Stop asking for THRE interrupts once there's nothing left to
+                // send. serial_write() turns them back on.
+                if (fill_fifo()) {
+                    set_ier(ier & ~IER_THRE);
+                }
+                break;
+            case IIR_RX_DATA:
+            case IIR_RX_TIMEOUT:
+                // Input is not supported yet, so discard it.
+                read_byte(COM1 + REG_DATA);
+                break;
+            case IIR_LINE_STATUS:
+                read_byte(COM1 + REG_LSR);
+                break;
+            case IIR_MODEM_STATUS:
+            default:
+                read_byte(COM1 + REG_MSR);
+                break;
+        }
+    }
+}
+
+bool serial_init(uint32_t baud) {
+    if (baud == 0 || baud > SERIAL_MAX_BAUD) {
+        return false;
+    }
+    uint16_t divisor = SERIAL_MAX_BAUD / baud;
+
+    set_ier(0);
+
+    write_byte(COM1 + REG_LCR, LCR_DLAB);
+    write_byte(COM1 + REG_DATA, divisor & 0xff);
+    write_byte(COM1 + REG_IER, divisor >> 8);
+    write_byte(COM1 + REG_LCR, LCR_8N1);
+
+    write_byte(COM1 + REG_FCR, FCR_ENABLE_FIFO);
+
+    // Check that the UART exists by sending a byte to ourselves in loopback
+    // mode.
+    write_byte(COM1 + REG_MCR, MCR_LOOPBACK);
+    write_byte(COM1 + REG_DATA, 0xae);
+    if (read_byte(COM1 + REG_DATA) != 0xae) {
+        return false;
+    }
+
+    write_byte(COM1 + REG_MCR, MCR_NORMAL);
+
+    idt_install_irq_handler(pic_get_vector(SERIAL_IRQ), serial_irq_handler);
+    irq_clear_mask(SERIAL_IRQ);
+
+    // Receive interrupts are enabled so that unread input can be discarded.
+    // Transmit interrupts are only enabled while there is something to send.
+    set_ier(IER_RDA);
+
+    initialised = true;
+    return true;
+}
+
+void serial_write(const char *s, uint32_t n) {
+    if (!initialised) {
+        return;
+    }
+
+    // Interrupts are disabled while the ring is updated, in case an interrupt
+    // handler which also writes to the serial port interrupts this one. This
+    // doesn't block the consumer: it only ever runs in interrupt context.
+    uint32_t flags = irq_save();
+
+    uint32_t head = tx_head;
+    uint32_t space = TX_RING_SIZE - (head - tx_tail);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t len = s[i] == '\n' ? 2 : 1;
+        if (len > space) {
+            dropped += n - i;
+            break;
+        }
+        if (s[i] == '\n') {
+            tx_ring[head++ & TX_RING_MASK] = '\r';
+        }
+        tx_ring[head++ & TX_RING_MASK] = s[i];
+        space -= len;
+    }
+
+    // Publish the new characters only after they have been written.
+    __asm__ volatile("" : : : "memory");
+    tx_head = head;
+
+    // Enabling the THRE interrupt while the transmitter is empty raises it
+    // immediately, which starts the transmission.
+    if (!(ier & IER_THRE)) {
+        set_ier(ier | IER_THRE);
+    }
+
+    irq_restore(flags);
+}
+
+void serial_flush() {
+    if (!initialised) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    while (tx_tail != tx_head) {
+        while ( !(read_byte(COM1 + REG_LSR) & LSR_THRE) );
+        fill_fifo();
+    }
+    irq_restore(flags);
+}
+
+uint32_t serial_get_dropped() {
+    return dropped;
+}
@@ -0,0 +1,43 @@
+#ifndef _DREWOS_SERIAL_H_
+#define _DREWOS_SERIAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Highest baud rate supported by a 16550 with the standard 1.8432 MHz clock.
+#define SERIAL_MAX_BAUD 115200
+
+/*
+Initialise the 16550 UART on COM1 with 8 data bits, no parity and 1 stop bit,
+and install its IRQ handler. Return false if no UART is present.
+
+@param baud: The baud rate. This must divide SERIAL_MAX_BAUD.
+*/
+bool serial_init(uint32_t baud);
+
+/*
+Queue characters for transmission on COM1. This doesn't wait for the line:
+characters are copied into a ring buffer, which is drained by the transmitter
+interrupt. Newlines are sent as CR LF. If the ring buffer is full, the excess
+characters are dropped.
+
+This has the signature of a console sink, so it can be passed to
+console_add_sink() to mirror console output to the serial port.
+
+@param s: The characters to be sent.
+@param n: Number of characters to be sent.
+*/
+void serial_write(const char *s, uint32_t n);
+
+/*
+Wait until every queued character has been handed to the UART. This polls the
+line, so it works with interrupts disabled, eg after a fatal error.
+*/
+void serial_flush();
+
+/*
+Get the number of characters dropped because the ring buffer was full.
+*/
+uint32_t serial_get_dropped();
+
+#endif // _DREWOS_SERIAL_H_
@@ -5,6 +5,10 @@
 #include "vga.h"
 #include "low_level.h"
 #include "util.h"
+#include "format.h"
+#include "memory.h"
+#include "clock.h"
+#include "dmath.h"
 
 // Screen device I/O ports.
 #define REG_CTRL 0x3d4
@@ -22,19 +26,110 @@
 // 757664 == 0xb8fa0
 #define VIDEO_MEMORY_MAX (VIDEO_MEMORY + 2 * NROW * NCOL)
 
+// Size of the video memory window in colour text mode (0xb8000 - 0xbffff).
+// Only the first NROW rows are visible at any one time.
+#define VIDEO_MEMORY_SIZE 0x8000
+
+// Number of whole rows which fit into video memory. In hardware scrolling mode,
+// video memory is treated as a ring of this many rows.
+#define RING_ROWS (VIDEO_MEMORY_SIZE / (2 * NCOL))
+
+// CRTC registers holding the high and low bytes of the start address. This is
+// the offset (in characters) of the first visible character in video memory.
+#define CRTC_START_ADDRESS_HIGH 0x0c
+#define CRTC_START_ADDRESS_LOW 0x0d
+
+// Size of the buffer into which messages are formatted before being written to
+// the console.
+#define CONSOLE_BUFSIZE 512
+
+// Maximum number of sinks which can mirror console output.
+#define MAX_CONSOLE_SINKS 4
+
+// Bitmask with one bit set for every row on the screen.
+#define ALL_ROWS ((1u << NROW) - 1)
+
 // Current screen coordinates. Note: this is not threadsafe!
 static uint8_t x = 0, y = 0;
 
-void clrscr() {
-    char *buf = (void *)VIDEO_MEMORY;
-    const int NVID_BUF = NROW * NCOL * 2;
+// The row of video memory currently displayed at the top of the screen.
+static uint16_t origin_row = 0;
+
+static scroll_mode_t scroll_mode = SCROLL_HARDWARE;
+
+// Off-screen copy of the text grid. Each cell holds the character in its low
+// byte and the attribute in its high byte, exactly as in video memory. Writes
+// go here first and are copied to video memory by console_flush(), because
+// writes to video memory are slow uncached accesses.
+//
+// The shadow buffer is itself a ring of rows, so that scrolling it doesn't
+// require any copying. Screen row 0 is stored in shadow[shadow_top].
+static uint16_t shadow[NROW][NCOL];
+static uint8_t shadow_top = 0;
+
+// Bitmask of screen rows which have changed since the last flush. Bit i
+// corresponds to screen row i.
+static uint32_t dirty_rows = 0;
+
+// Number of times the screen has been scrolled since the last flush.
+static uint32_t pending_scroll = 0;
+
+// Sinks which receive a copy of everything written to the console.
+static console_sink_t sinks[MAX_CONSOLE_SINKS];
+static uint8_t nsinks = 0;
+
+/*
+Set the row of video memory displayed at the top of the screen, by writing the
+corresponding character offset into the CRTC start address registers.
+*/
+static void set_origin(uint16_t row) {
+    uint16_t offset = row * NCOL;
+    origin_row = row;
+
+    write_byte(REG_CTRL, CRTC_START_ADDRESS_HIGH);
+    write_byte(REG_DATA, (uint8_t)((offset >> 8) & 0xff));
+    write_byte(REG_CTRL, CRTC_START_ADDRESS_LOW);
+    write_byte(REG_DATA, (uint8_t)(offset & 0xff));
+}
+
+/*
+Get the row of the shadow buffer which is displayed on the given screen row.
+*/
+static uint16_t *get_shadow_row(uint8_t y) {
+    return shadow[(shadow_top + y) % NROW];
+}
+
+/*
+Blank out a row of the shadow buffer.
+
+@param y: The screen row.
+*/
+static void clear_row(uint8_t y) {
+    memset16(get_shadow_row(y), ' ', NCOL);
+    dirty_rows |= 1u << y;
+}
 
-    for (int i = 0; i < NVID_BUF; i += 2) {
-        *(buf++) = (char)' ';
-        *(buf++) = (char)0;
+void clrscr() {
+    shadow_top = 0;
+    pending_scroll = 0;
+    for (uint8_t row = 0; row < NROW; row++) {
+        clear_row(row);
     }
+    set_origin(0);
     x = 0;
     y = 0;
+    console_flush();
+}
+
+void vga_set_scroll_mode(scroll_mode_t mode) {
+    // Software scrolling always displays the first NROW rows of video memory,
+    // so bring the visible rows back to the start before switching.
+    if (mode == SCROLL_SOFTWARE && origin_row != 0) {
+        set_origin(0);
+        dirty_rows = ALL_ROWS;
+    }
+    scroll_mode = mode;
+    console_flush();
 }
 
 void print_coords();
@@ -51,10 +146,10 @@ uint16_t get_offset(uint8_t x, uint8_t y) {
 }
 
 /*
-Get the address in video memory representing the given coordinates.
+Get the address in video memory representing the given screen coordinates.
 */
 char *get_address(uint8_t x, uint8_t y) {
-    return get_offset(x, y) + (char *)VIDEO_MEMORY;
+    return get_offset(x, y + origin_row) + (char *)VIDEO_MEMORY;
 }
 
 /*
@@ -113,7 +208,7 @@ void set_cursor(uint16_t offset) {
 Set the location of the cursor to the given screen coordinates.
 */
 void set_cursor_screen(uint8_t x, uint8_t y) {
-    uint16_t offset = get_offset(x, y) % (NCOL * NROW * 2);
+    uint16_t offset = (x + (y + origin_row) * NCOL) % (NCOL * RING_ROWS);
     set_cursor(offset);
 }
 
@@ -137,61 +232,67 @@ void disable_cursor() {
 }
 
 /*
-Ensure that the current x and y coordinates point to a cell on the screen (ie
-within the first NROW rows. If not, scroll all existing text up by 1 row and
-empty the bottom row of text.
+Bring the visible window of video memory up to date with any scrolling done in
+the shadow buffer since the last flush.
+
+In software scrolling mode, the window never moves, so every row must be
+rewritten. In hardware scrolling mode, the window is moved further into video
+memory by reprogramming the CRTC start address, and only the rows which have
+scrolled into view need to be written. When the window would run past the end
+of video memory, it wraps back to the start, and every row is rewritten.
 */
-void handle_scrolling() {
-    if (y < NROW) {
+static void flush_scrolling() {
+    if (!pending_scroll) {
         return;
     }
 
-    // const uint16_t n = 16;
-    // char buf[n];
-    uint8_t yy = y;
-    uint8_t xx = x;
-
-    // Move all rows back by 1.
-    for (uint8_t i = 1; i < NROW; i++) {
-        char *src = get_address(0, i);
-        char *dst = get_address(0, i - 1);
-
-        // y = i - 1;
-        // x = NCOL - 19;
-
-        // uint16_t res = itoh((uintptr_t)src, buf, n);
-        // if (!res) {
-        //     cprint(buf, RED, BLACK);
-        // }
-        // cprint(" -> ", RED, BLACK);
-        // res = itoh((uintptr_t)dst, buf, n);
-        // if (!res) {
-        //     cprint(buf, RED, BLACK);
-        // }
-
-        copy_memory(src, dst, NCOL * 2);
+    if (scroll_mode == SCROLL_HARDWARE) {
+        uint32_t row = origin_row + pending_scroll;
+        if (row + NROW > RING_ROWS) {
+            row = 0;
+            dirty_rows = ALL_ROWS;
+        }
+        set_origin(row);
+    } else {
+        dirty_rows = ALL_ROWS;
     }
 
-    // y = NROW - 1;
-    // x = NCOL - 14;
-    // cprint("copy success", GREEN, BLACK);
+    pending_scroll = 0;
+}
 
-    y = yy;
-    x = xx;
+void console_flush() {
+    flush_scrolling();
+
+    for (uint8_t i = 0; dirty_rows; i++, dirty_rows >>= 1) {
+        if (!(dirty_rows & 1)) {
+            continue;
+        }
 
-    // Empty the last line.
-    char *prv = get_address(0, NROW - 1);
-    for (uint8_t i = 0; i < NCOL * 2; i += 2) {
-        prv[i] = (char)(' ' & 0xff);
-        prv[i + 1] = (char)(0 & 0xff);
+        memcpy(get_address(0, i), get_shadow_row(i), 2 * NCOL);
     }
+}
 
-    x = 0;
-    y = NROW - 1;
+/*
+Ensure that the current x and y coordinates point to a cell on the screen (ie
+within the first NROW rows. If not, scroll all existing text up and empty the
+bottom row of text.
+
+Scrolling only rotates the shadow buffer; video memory is updated on the next
+flush.
+*/
+void handle_scrolling() {
+    while (y >= NROW) {
+        shadow_top = (shadow_top + 1) % NROW;
+        dirty_rows >>= 1;
+        pending_scroll++;
+        clear_row(NROW - 1);
+        y--;
+    }
 }
 
 /*
-Write the specified character to the screen at the current x/y coordinates.
+Write the specified character to the current x/y coordinates. The character
+will appear on the screen on the next flush.
 */
 void write_char(char c, colour_t fg, colour_t bg) {
     if (c == '\n') {
@@ -209,83 +310,68 @@ void write_char(char c, colour_t fg, colour_t bg) {
     // TODO: handle other non-printing characters?
 
     // Ensure we're printing onto the screen, and scroll existing text buffer
-    // up 1 row if not.
+    // up if not.
     handle_scrolling();
 
-    char *buf = get_address(x, y);
-    (*buf++) = c;
-    (*buf++) = (bg << 4) + fg;
+    get_shadow_row(y)[x] = (uint8_t)c | (((bg << 4) + fg) << 8);
+    dirty_rows |= 1u << y;
 
-    // Get the offset in number of characters from the start of the buffer.
-    uint16_t offset = (buf - (char *)VIDEO_MEMORY) / 2;
+    // Update x/y globals. Wrapping onto the next line is handled the same way
+    // as a newline.
+    if (++x == NCOL) {
+        x = 0;
+        y++;
+    }
+}
 
-    // Move the cursor to this location.
-    // set_cursor(offset - 1);
+void console_write(const char *s, uint32_t n, colour_t fg, colour_t bg) {
+    for (uint32_t i = 0; i < n; i++) {
+        write_char(s[i], fg, bg);
+    }
 
-    // Update x/y globals.
-    y = offset / NCOL;
-    x = offset % NCOL;
+    for (uint8_t i = 0; i < nsinks; i++) {
+        sinks[i](s, n);
+    }
+}
 
-    // Handle scrolling if necessary.
-    handle_scrolling();
+bool console_add_sink(console_sink_t sink) {
+    if (nsinks == MAX_CONSOLE_SINKS) {
+        return false;
+    }
+    sinks[nsinks++] = sink;
+    return true;
 }
 
-void _cprint(const char *msg, colour_t fg, colour_t bg, va_list args) {
+/*
+Format a message and write it to the console in a single span, optionally
+followed by a newline.
+*/
+static void format_and_write(const char *msg, colour_t fg, colour_t bg, va_list args, bool newline) {
     if (!msg) {
-        return;
+        msg = "";
     }
 
-    char var_char;
-    int32_t var_int32;
-    // uint32_t var_uint32;
-    // int64_t var_long;
-    // uint64_t var_ulong;
-    char *var_str;
-    const uint8_t bufsize = 32;
-    char buf[bufsize];
-
-    char c;
-    while ( (c = *msg++) ) {
-        if (c == '%') {
-            // Parse format specifier.
-            switch ( (c = *msg++)) {
-                case '%':
-                    // %% - Literal % character.
-                    write_char('%', fg, bg);
-                    break;
-                case 'c':
-                    // %c - Print out the character.
-                    var_char = va_arg(args, int);
-                    write_char(var_char, fg, bg);
-                    break;
-                case 's':
-                    // %s - Print out the string.
-                    var_str = va_arg(args, char *);
-                    while ( (var_char = *var_str++) ) {
-                        write_char(var_char, fg, bg);
-                    }
-                    break;
-                case 'd':
-                    // %d - Print out the number.
-                    var_int32 = va_arg(args, int32_t);
-                    itoa(var_int32, buf, bufsize);
-                    for (uint8_t i = 0; buf[i]; i++) {
-                        write_char(buf[i], fg, bg);
-                    }
-                    break;
-                case 'x':
-                    // %x - Print out the number in hex.
-                    var_int32 = va_arg(args, int32_t);
-                    itoh(var_int32, buf, bufsize);
-                    for (uint8_t i = 0; buf[i]; i++) {
-                        write_char(buf[i], fg, bg);
-                    }
-                    break;
-            }
-        } else {
-            write_char(c, fg, bg);
-        }
+    // Format the whole message up front, so that it can be passed to the
+    // console in a single call. Leave room for the newline. Longer messages are
+    // truncated.
+    char buf[CONSOLE_BUFSIZE];
+    uint32_t len = kvsnprintf(buf, CONSOLE_BUFSIZE - 1, msg, args);
+    if (len >= CONSOLE_BUFSIZE - 1) {
+        len = CONSOLE_BUFSIZE - 2;
+    }
+
+    if (newline) {
+        buf[len++] = '\n';
+    }
+
+    console_write(buf, len, fg, bg);
+}
+
+void _cprint(const char *msg, colour_t fg, colour_t bg, va_list args) {
+    if (!msg) {
+        return;
     }
+    format_and_write(msg, fg, bg, args, false);
 }
 
 void cprint(const char *msg, colour_t fg, colour_t bg, ...) {
@@ -296,10 +382,10 @@ void cprint(const char *msg, colour_t fg, colour_t bg, ...) {
 }
 
 void _cprintln(const char *msg, colour_t fg, colour_t bg, va_list args) {
-    _cprint(msg, fg, bg, args);
+    format_and_write(msg, fg, bg, args, true);
     // print_offset();
     // print_coords();
-    write_char('\n', fg, bg);
+    console_flush();
 }
 
 void cprintln(const char *msg, colour_t fg, colour_t bg, ...) {
@@ -368,3 +454,28 @@ void print_coords() {
 
     cprint(")", CYAN, BLACK);
 }
+
+void vga_scroll_benchmark(uint16_t nscroll) {
+    scroll_mode_t mode = scroll_mode;
+    uint64_t us[2];
+    const scroll_mode_t modes[2] = { SCROLL_SOFTWARE, SCROLL_HARDWARE };
+
+    for (uint8_t i = 0; i < 2; i++) {
+        vga_set_scroll_mode(modes[i]);
+
+        uint64_t start = ktime_ns();
+        for (uint16_t j = 0; j < nscroll; j++) {
+            // Flush after every row, as println() would.
+            y = NROW;
+            handle_scrolling();
+            console_flush();
+        }
+        us[i] = ktime_ns() - start;
+        div64_32(&us[i], NSEC_PER_USEC);
+    }
+
+    vga_set_scroll_mode(mode);
+
+    println("Scrolled %u rows: software = %llu us, hardware = %llu us",
+            nscroll, us[0], us[1]);
+}
@@ -2,6 +2,7 @@
 #define _DREWOS_VGA_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 // Colours usable in VGA colour text mode.
 typedef enum {
@@ -23,8 +24,67 @@ typedef enum {
     WHITE        = 15
 } colour_t;
 
+// Strategies for scrolling the screen.
+typedef enum {
+    // Copy every row of the screen up by one row in video memory.
+    SCROLL_SOFTWARE,
+    // Move the visible window through video memory by reprogramming the CRTC
+    // start address, copying only when the window reaches the end of video
+    // memory.
+    SCROLL_HARDWARE
+} scroll_mode_t;
+
+// A function which receives a copy of all text written to the console, eg to
+// mirror it to a serial port. The text is passed one span at a time, and is not
+// NULL-terminated.
+typedef void (*console_sink_t)(const char *s, uint32_t n);
+
 void clrscr();
 
+/*
+Copy all changes made since the last flush to video memory. Text written to the
+console is buffered off-screen until it is flushed. This happens automatically
+at the end of every println() and cprintln().
+*/
+void console_flush();
+
+/*
+Select the strategy used to scroll the screen. Hardware scrolling is used by
+default.
+
+@param mode: The scrolling strategy.
+*/
+void vga_set_scroll_mode(scroll_mode_t mode);
+
+/*
+Scroll the screen the specified number of times using each scrolling strategy,
+and print the time taken by each. Note that this scrolls the
+current screen contents away.
+
+@param nscroll: Number of rows to scroll with each strategy.
+*/
+void vga_scroll_benchmark(uint16_t nscroll);
+
+/*
+Write a string of characters to the console, in the specified colour, and pass
+them on to every registered sink. Unlike the print functions, no formatting is
+applied.
+
+@param s: The characters to be written.
+@param n: Number of characters to be written.
+@param fg: Foreground colour of the text.
+@param bg: Background colour of the text.
+*/
+void console_write(const char *s, uint32_t n, colour_t fg, colour_t bg);
+
+/*
+Register a sink which will receive a copy of everything subsequently written to
+the console. Return false if too many sinks are already registered.
+
+@param sink: The sink.
+*/
+bool console_add_sink(console_sink_t sink);
+
 /*
 Print a message in the specified colour with a newline at the end.
 
@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "apic.h"
+#include "clock.h"
+#include "cpuid.h"
+#include "dmath.h"
+#include "low_level.h"
+#include "madt.h"
+#include "vga.h"
+
+// Model-specific register holding the local APIC's base address.
+#define IA32_APIC_BASE 0x1b
+
+// Global enable bit of IA32_APIC_BASE.
+#define APIC_BASE_ENABLE (1 << 11)
+
+// Model-specific register which arms the local APIC timer in TSC-deadline mode.
+#define IA32_TSC_DEADLINE 0x6e0
+
+// Local APIC registers (byte offsets from the base address).
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xb0
+#define LAPIC_SVR 0xf0
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3e0
+
+// Software enable bit of the spurious interrupt vector register.
+#define SVR_ENABLE 0x100
+
+// Local vector table bits.
+#define LVT_MASKED (1 << 16)
+#define LVT_TIMER_ONESHOT (0 << 17)
+#define LVT_TIMER_TSC_DEADLINE (2 << 17)
+
+// Divide configuration register value which counts down once every 16 bus
+// clocks.
+#define TIMER_DIVIDE_16 0x3
+
+// Longest time for which the timer is armed in one go. Any counter running at
+// up to 4 GHz counts this far without overflowing 64 bits.
+#define TIMER_MAX_NS (4ull * NSEC_PER_SEC)
+
+// The rate of the local APIC timer is measured by letting it count down for
+// this long.
+#define TIMER_CALIBRATE_US 10000
+
+// I/O APIC registers are accessed indirectly: the register number is written
+// to IOREGSEL, and the register is then accessed through IOWIN.
+#define IOAPIC_IOREGSEL 0x00
+#define IOAPIC_IOWIN 0x10
+
+// I/O APIC register numbers.
+#define IOAPIC_VER 0x01
+
+// Each redirection entry occupies two registers, starting from this one.
+#define IOAPIC_REDTBL 0x10
+
+// Redirection entry bits (low dword).
+#define REDIR_ACTIVE_LOW (1 << 13)
+#define REDIR_LEVEL (1 << 15)
+#define REDIR_MASKED (1 << 16)
+
+// Shift of the destination APIC ID in the high dword of a redirection entry.
+#define REDIR_DEST_SHIFT 24
+
+// Polarity and trigger mode of PCI interrupts, which are used for IRQs above
+// the ISA range.
+#define PCI_IRQ_FLAGS (MADT_POLARITY_ACTIVE_LOW | MADT_TRIGGER_LEVEL)
+
+static volatile uint32_t *lapic = 0;
+static bool enabled = false;
+static uint8_t apic_id = 0;
+
+// Number of inputs of each I/O APIC.
+static uint16_t ioapic_lines[MADT_MAX_IOAPICS];
+
+static const madt_info_t *madt = 0;
+
+// Whether the local APIC timer is armed with IA32_TSC_DEADLINE, and otherwise
+// the rate at which it counts down.
+static bool tsc_deadline = false;
+static uint32_t timer_freq_hz = 0;
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(uint32_t base, uint8_t reg) {
+    volatile uint32_t *ioapic = (volatile uint32_t *)base;
+    ioapic[IOAPIC_IOREGSEL / 4] = reg;
+    return ioapic[IOAPIC_IOWIN / 4];
+}
+
+static void ioapic_write(uint32_t base, uint8_t reg, uint32_t value) {
+    volatile uint32_t *ioapic = (volatile uint32_t *)base;
+    ioapic[IOAPIC_IOREGSEL / 4] = reg;
+    ioapic[IOAPIC_IOWIN / 4] = value;
+}
+
+/*
+Find the I/O APIC which receives a global system interrupt. Return its index in
+the MADT's list of I/O APICs, or -1 if there is none.
+*/
+static int8_t find_ioapic(uint32_t gsi) {
+    for (uint8_t i = 0; i < madt->nioapic; i++) {
+        uint32_t base = madt->ioapics[i].gsi_base;
+        if (gsi >= base && gsi < base + ioapic_lines[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool apic_init() {
+    if (!cpu_has_feature(CPU_FEATURE_APIC)) {
+        return false;
+    }
+
+    madt = madt_get_info();
+    if (!madt || madt->nioapic == 0) {
+        return false;
+    }
+
+    // The firmware may have left the APIC globally disabled.
+    write_msr(IA32_APIC_BASE, read_msr(IA32_APIC_BASE) | APIC_BASE_ENABLE);
+
+    lapic = (volatile uint32_t *)madt->lapic_address;
+
+    // Accept interrupts of every priority, and software-enable the APIC.
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    apic_id = lapic_read(LAPIC_ID) >> 24;
+
+    // Mask every input. IRQs are unmasked one at a time by ioapic_set_mask().
+    for (uint8_t i = 0; i < madt->nioapic; i++) {
+        uint32_t base = madt->ioapics[i].address;
+        ioapic_lines[i] = ((ioapic_read(base, IOAPIC_VER) >> 16) & 0xff) + 1;
+        for (uint16_t line = 0; line < ioapic_lines[i]; line++) {
+            ioapic_write(base, IOAPIC_REDTBL + 2 * line, REDIR_MASKED);
+        }
+    }
+
+    enabled = true;
+    return true;
+}
+
+bool apic_enabled() {
+    return enabled;
+}
+
+void apic_send_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint8_t apic_get_id() {
+    return apic_id;
+}
+
+void ioapic_set_mask(uint8_t irq, bool masked) {
+    if (!enabled || irq >= APIC_MAX_IRQS) {
+        return;
+    }
+
+    uint16_t flags = PCI_IRQ_FLAGS;
+    uint32_t gsi = irq < 16 ? madt_irq_to_gsi(irq, &flags) : irq;
+
+    int8_t i = find_ioapic(gsi);
+    if (i < 0) {
+        return;
+    }
+    uint32_t base = madt->ioapics[i].address;
+    uint8_t reg = IOAPIC_REDTBL + 2 * (gsi - madt->ioapics[i].gsi_base);
+
+    if (masked) {
+        ioapic_write(base, reg, ioapic_read(base, reg) | REDIR_MASKED);
+        return;
+    }
+
+    // Fixed delivery, physical destination mode, to this CPU.
+    uint32_t low = APIC_IRQ_BASE + irq;
+    if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_ACTIVE_LOW) {
+        low |= REDIR_ACTIVE_LOW;
+    }
+    if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) {
+        low |= REDIR_LEVEL;
+    }
+    ioapic_write(base, reg + 1, (uint32_t)apic_id << REDIR_DEST_SHIFT);
+    ioapic_write(base, reg, low);
+}
+
+/*
+Measure the rate at which the local APIC timer counts down. Return 0 if it
+couldn't be measured.
+*/
+static uint32_t calibrate_timer() {
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LVT_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+
+    uint64_t start = ktime_ns();
+    lapic_write(LAPIC_TIMER_INITIAL, 0xffffffff);
+    udelay(TIMER_CALIBRATE_US);
+    uint32_t count = 0xffffffff - lapic_read(LAPIC_TIMER_CURRENT);
+    uint64_t elapsed = ktime_ns() - start;
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    if (!elapsed || elapsed >> 32) {
+        return 0;
+    }
+
+    // freq = count / (elapsed / NSEC_PER_SEC)
+    uint64_t freq = (uint64_t)count * NSEC_PER_SEC;
+    div64_32(&freq, (uint32_t)elapsed);
+    return freq >> 32 ? 0 : (uint32_t)freq;
+}
+
+bool apic_timer_init() {
+    if (!enabled) {
+        return false;
+    }
+
+    if (cpu_has_feature(CPU_FEATURE_TSC_DEADLINE) && tsc_get_freq_hz()) {
+        tsc_deadline = true;
+        lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_TSC_DEADLINE | APIC_TIMER_VECTOR);
+        println("APIC timer: TSC-deadline mode");
+        return true;
+    }
+
+    timer_freq_hz = calibrate_timer();
+    if (!timer_freq_hz) {
+        return false;
+    }
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+
+    uint32_t khz = timer_freq_hz / 1000;
+    println("APIC timer: one-shot mode at %u.%03u MHz", khz / 1000, khz % 1000);
+    return true;
+}
+
+/*
+Convert a number of nanoseconds to ticks of a counter, saturating at ~0.
+*/
+static uint64_t ns_to_cycles(uint64_t ns, uint32_t freq_hz) {
+    // Keep ns * freq_hz within 64 bits. A longer sleep is cut short, and the
+    // caller simply sleeps again.
+    if (ns > TIMER_MAX_NS) {
+        ns = TIMER_MAX_NS;
+    }
+    uint64_t cycles = ns * freq_hz;
+    div64_32(&cycles, NSEC_PER_SEC);
+    return cycles;
+}
+
+void apic_timer_arm(uint64_t ns) {
+    if (tsc_deadline) {
+        write_msr(IA32_TSC_DEADLINE, read_tsc() + ns_to_cycles(ns, tsc_get_freq_hz()) + 1);
+        return;
+    }
+    if (!timer_freq_hz) {
+        return;
+    }
+
+    // A count of 0 stops the timer, so always count at least once.
+    uint64_t count = ns_to_cycles(ns, timer_freq_hz) + 1;
+    lapic_write(LAPIC_TIMER_INITIAL, count >> 32 ? 0xffffffff : (uint32_t)count);
+}
+
+void apic_timer_cancel() {
+    if (tsc_deadline) {
+        write_msr(IA32_TSC_DEADLINE, 0);
+    } else if (timer_freq_hz) {
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _DREWOS_APIC_H_
+#define _DREWOS_APIC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Vector of IRQ 0 when interrupts are delivered by the I/O APIC. IRQ n uses
+// vector APIC_IRQ_BASE + n, the same as with the 8259 PICs after pic_init().
+#define APIC_IRQ_BASE 0x20
+
+// Number of IRQs which can be routed through the I/O APIC. IRQs 0-15 are ISA
+// IRQs, and higher IRQs are the I/O APIC inputs of the same number.
+#define APIC_MAX_IRQS 24
+
+// Vector raised by the local APIC for spurious interrupts. These don't need an
+// EOI.
+#define APIC_SPURIOUS_VECTOR 0xff
+
+// Vector raised by the local APIC timer. The handler must call apic_send_eoi().
+#define APIC_TIMER_VECTOR 0xf0
+
+/*
+Enable the local APIC of this CPU, and mask every I/O APIC input. Return false
+if the CPU has no APIC, or if the MADT doesn't describe an I/O APIC. This must
+be called after the MADT has been parsed.
+
+This doesn't disable the 8259 PICs. See pic_switch_to_apic().
+*/
+bool apic_init();
+
+/*
+Check whether interrupts are delivered by the APIC.
+*/
+bool apic_enabled();
+
+/*
+Signal the end of an interrupt to the local APIC.
+*/
+void apic_send_eoi();
+
+/*
+Get the local APIC ID of this CPU.
+*/
+uint8_t apic_get_id();
+
+/*
+Mask or unmask an IRQ in the I/O APIC. Unmasking an IRQ programs its
+redirection entry, so it's delivered to this CPU with vector
+APIC_IRQ_BASE + irq.
+
+@param irq: The IRQ.
+@param masked: True to mask the IRQ, false to unmask it.
+*/
+void ioapic_set_mask(uint8_t irq, bool masked);
+
+/*
+Prepare the local APIC timer for use in one-shot mode. If the CPU supports it,
+the timer is run in TSC-deadline mode; otherwise its rate is measured against
+the clock. Return false if the APIC isn't enabled. This must be called after
+apic_init() and clock_init().
+*/
+bool apic_timer_init();
+
+/*
+Raise APIC_TIMER_VECTOR once, after the specified time. This replaces any
+earlier time which hasn't yet passed. Times longer than the timer can count are
+shortened, so the interrupt may arrive early, but never late.
+
+@param ns: Number of nanoseconds from now.
+*/
+void apic_timer_arm(uint64_t ns);
+
+/*
+Stop the local APIC timer, if it's armed.
+*/
+void apic_timer_cancel();
+
+#endif // _DREWOS_APIC_H_
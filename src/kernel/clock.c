@@ -0,0 +1,379 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "clock.h"
+#include "cpuid.h"
+#include "dmath.h"
+#include "idt.h"
+#include "low_level.h"
+#include "pic.h"
+#include "vga.h"
+
+// Programmable interval timer (8253/8254) ports.
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+
+// Input clock of the PIT.
+#define PIT_FREQ 1193182
+
+#define PIT_IRQ 0
+
+// Command byte fields.
+#define PIT_SELECT_CHANNEL0 0x00
+#define PIT_SELECT_CHANNEL2 0x80
+#define PIT_ACCESS_LOHI 0x30
+#define PIT_MODE_TERMINAL_COUNT 0x00
+#define PIT_MODE_RATE_GENERATOR 0x04
+
+// Reload value for channel 0, which divides the input clock down to CLOCK_HZ.
+#define PIT_LATCH ((PIT_FREQ + CLOCK_HZ / 2) / CLOCK_HZ)
+
+// Port B of the keyboard controller, which controls the gate input of PIT
+// channel 2, and the PC speaker, and reports the state of channel 2's output.
+#define PORT_B 0x61
+#define PORT_B_GATE2 0x01
+#define PORT_B_SPEAKER 0x02
+#define PORT_B_OUT2 0x20
+
+// The TSC is calibrated by counting cycles while PIT channel 2 counts down
+// for this long. The shortest of several attempts is used, as an interrupt
+// or SMI can only make an attempt take longer.
+#define CALIBRATE_MS 10
+#define CALIBRATE_LATCH (PIT_FREQ * CALIBRATE_MS / 1000)
+#define CALIBRATE_ATTEMPTS 3
+
+// Clocksource ratings. The TSC is only preferred over other counters if its
+// rate doesn't change with the CPU's power state.
+#define RATING_PIT 50
+#define RATING_TSC 150
+#define RATING_TSC_INVARIANT 300
+
+static volatile uint64_t ticks = 0;
+
+// Once the periodic tick has been stopped, ticks are counted from ktime_ns()
+// instead, carrying on from tick_base at tick_base_ns.
+static bool tickless = false;
+static uint64_t tick_base = 0;
+static uint64_t tick_base_ns = 0;
+
+static uint64_t read_ticks() {
+    return ticks;
+}
+
+static clocksource_t pit_clocksource = {
+    .name = "pit",
+    .read = read_ticks,
+    .mask = ~0ull,
+    .freq_hz = CLOCK_HZ,
+    .rating = RATING_PIT
+};
+
+static clocksource_t tsc_clocksource = {
+    .name = "tsc",
+    .read = read_tsc,
+    .mask = ~0ull,
+    .freq_hz = 0,
+    .rating = RATING_TSC
+};
+
+// Maximum number of clocksources which can be registered.
+#define MAX_CLOCKSOURCES 8
+
+static clocksource_t *sources[MAX_CLOCKSOURCES];
+static uint8_t nsources = 0;
+
+static clocksource_t *source = 0;
+
+// Time at which the clocksource last read base_cycles. ktime_ns() counts
+// forward from here.
+static uint64_t base_cycles = 0;
+static uint64_t base_ns = 0;
+
+uint64_t clocksource_to_ns(const clocksource_t *cs, uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, cs->mult, cs->shift);
+}
+
+/*
+Compute a clocksource's mult and shift. The largest shift for which mult still
+fits in 32 bits gives the most precise conversion.
+*/
+static void calc_mult_shift(clocksource_t *cs) {
+    for (uint32_t shift = 32; shift > 0; shift--) {
+        uint64_t mult = (uint64_t)NSEC_PER_SEC << shift;
+        div64_32(&mult, cs->freq_hz);
+        if (mult >> 32 == 0) {
+            cs->mult = (uint32_t)mult;
+            cs->shift = shift;
+            return;
+        }
+    }
+    cs->mult = NSEC_PER_SEC / cs->freq_hz;
+    cs->shift = 0;
+}
+
+/*
+Read the current time. Interrupts must be disabled.
+*/
+static uint64_t read_ns() {
+    if (!source) {
+        return 0;
+    }
+
+    uint64_t now = source->read();
+    uint64_t delta = (now - base_cycles) & source->mask;
+    uint64_t ns = base_ns + clocksource_to_ns(source, delta);
+
+    // Move the base forward before the counter can wrap around past it.
+    if (delta > source->mask >> 1) {
+        base_cycles = now;
+        base_ns = ns;
+    }
+    return ns;
+}
+
+uint64_t ktime_ns() {
+    uint32_t flags = irq_save();
+    uint64_t ns = read_ns();
+    irq_restore(flags);
+    return ns;
+}
+
+void clock_register(clocksource_t *cs) {
+    calc_mult_shift(cs);
+
+    if (nsources < MAX_CLOCKSOURCES) {
+        sources[nsources++] = cs;
+    }
+
+    uint32_t flags = irq_save();
+    if (!source || cs->rating > source->rating) {
+        // Carry on from the current time, so that time doesn't jump.
+        base_ns = read_ns();
+        base_cycles = cs->read();
+        source = cs;
+    }
+    irq_restore(flags);
+}
+
+const clocksource_t *clock_get_source() {
+    return source;
+}
+
+uint64_t clock_get_ticks() {
+    uint32_t flags = irq_save();
+    uint64_t t = ticks;
+    if (tickless) {
+        uint64_t elapsed = read_ns() - tick_base_ns;
+        div64_32(&elapsed, NSEC_PER_SEC / CLOCK_HZ);
+        t = tick_base + elapsed;
+    }
+    irq_restore(flags);
+    return t;
+}
+
+bool clock_stop_tick() {
+    if (tickless) {
+        return true;
+    }
+
+    // The PIT clocksource only advances on the tick.
+    if (!source || source == &pit_clocksource) {
+        return false;
+    }
+
+    irq_set_mask(PIT_IRQ);
+
+    uint32_t flags = irq_save();
+    tick_base = ticks;
+    tick_base_ns = read_ns();
+    tickless = true;
+    irq_restore(flags);
+    return true;
+}
+
+uint64_t clock_max_idle_ns() {
+    if (!source || source->mask == ~0ull) {
+        return ~0ull;
+    }
+
+    // read_ns() only moves the base once it's more than half a wraparound
+    // behind, so after a read, the counter may be just under half a
+    // wraparound from wrapping past it. Sleeping for at most a quarter of a
+    // wraparound leaves a quarter as margin for oversleeping, eg from
+    // wakeup latency or error in the wakeup timer's calibration.
+    return clocksource_to_ns(source, source->mask >> 2);
+}
+
+void udelay(uint32_t us) {
+    if (!source) {
+        return;
+    }
+
+    uint64_t end = ktime_ns() + (uint64_t)us * NSEC_PER_USEC;
+    while (ktime_ns() < end) {
+        __asm__ volatile("pause");
+    }
+}
+
+uint64_t tsc_to_ns(uint64_t cycles) {
+    if (!tsc_clocksource.freq_hz) {
+        return 0;
+    }
+    return clocksource_to_ns(&tsc_clocksource, cycles);
+}
+
+uint32_t tsc_get_freq_hz() {
+    return tsc_clocksource.freq_hz;
+}
+
+static void pit_irq_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    ticks++;
+
+    // Read the clock once a second, so that the base is moved forward
+    // before a narrow counter can wrap around.
+    if ((uint32_t)ticks % CLOCK_HZ == 0) {
+        read_ns();
+    }
+}
+
+/*
+Count the TSC cycles taken by PIT channel 2 to count down from CALIBRATE_LATCH.
+*/
+static uint64_t time_pit_countdown() {
+    uint8_t port_b = read_byte(PORT_B);
+
+    // Enable channel 2's gate, but keep the speaker off.
+    write_byte(PORT_B, (port_b & ~PORT_B_SPEAKER) | PORT_B_GATE2);
+
+    // In terminal count mode, the output goes high when the count reaches 0.
+    write_byte(PIT_COMMAND, PIT_SELECT_CHANNEL2 | PIT_ACCESS_LOHI | PIT_MODE_TERMINAL_COUNT);
+    write_byte(PIT_CHANNEL2, CALIBRATE_LATCH & 0xff);
+    write_byte(PIT_CHANNEL2, CALIBRATE_LATCH >> 8);
+
+    uint64_t start = read_tsc();
+    while (!(read_byte(PORT_B) & PORT_B_OUT2));
+    uint64_t cycles = read_tsc() - start;
+
+    write_byte(PORT_B, port_b);
+    return cycles;
+}
+
+/*
+Measure the frequency of the TSC against the PIT. Return 0 if it's too fast to
+be represented.
+*/
+static uint32_t calibrate_tsc() {
+    uint64_t best = ~0ull;
+
+    uint32_t flags = irq_save();
+    for (uint8_t i = 0; i < CALIBRATE_ATTEMPTS; i++) {
+        uint64_t cycles = time_pit_countdown();
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    irq_restore(flags);
+
+    // freq = cycles / (CALIBRATE_LATCH / PIT_FREQ)
+    uint64_t freq = best * PIT_FREQ;
+    div64_32(&freq, CALIBRATE_LATCH);
+    return freq >> 32 ? 0 : (uint32_t)freq;
+}
+
+/*
+Measure the frequency of the TSC against another clocksource. Return 0 if it's
+too fast to be represented.
+*/
+static uint32_t calibrate_tsc_against(const clocksource_t *ref) {
+    uint32_t ref_ticks = ref->freq_hz / 1000 * CALIBRATE_MS;
+
+    uint32_t flags = irq_save();
+
+    // Start and stop on a change of the reference counter, so that the
+    // measurement isn't out by up to one of its ticks at each end.
+    uint64_t start = ref->read();
+    uint64_t now;
+    while ((now = ref->read()) == start);
+    start = now;
+    uint64_t tsc_start = read_tsc();
+
+    uint64_t delta;
+    do {
+        now = ref->read();
+        delta = (now - start) & ref->mask;
+    } while (delta < ref_ticks);
+    uint64_t cycles = read_tsc() - tsc_start;
+
+    irq_restore(flags);
+
+    // freq = cycles / (delta / ref->freq_hz)
+    uint64_t freq = cycles * ref->freq_hz;
+    div64_32(&freq, (uint32_t)delta);
+    return freq >> 32 ? 0 : (uint32_t)freq;
+}
+
+void clock_calibrate_tsc() {
+    if (!tsc_clocksource.freq_hz) {
+        return;
+    }
+
+    // Use the best clocksource other than the TSC itself. The PIT tick count
+    // is too coarse to improve on the initial calibration.
+    const clocksource_t *ref = 0;
+    for (uint8_t i = 0; i < nsources; i++) {
+        clocksource_t *cs = sources[i];
+        if (cs == &tsc_clocksource || cs == &pit_clocksource) {
+            continue;
+        }
+        if (!ref || cs->rating > ref->rating) {
+            ref = cs;
+        }
+    }
+    if (!ref) {
+        return;
+    }
+
+    uint32_t freq = calibrate_tsc_against(ref);
+    if (!freq) {
+        return;
+    }
+
+    // If the TSC is in use, rebase the clock before its conversion changes,
+    // so that time doesn't jump.
+    uint32_t flags = irq_save();
+    if (source == &tsc_clocksource) {
+        base_ns = read_ns();
+        base_cycles = read_tsc();
+    }
+    tsc_clocksource.freq_hz = freq;
+    calc_mult_shift(&tsc_clocksource);
+    irq_restore(flags);
+
+    uint32_t khz = freq / 1000;
+    println("Clock: TSC calibrated against %s: %u.%03u MHz; using %s", ref->name, khz / 1000, khz % 1000, source->name);
+}
+
+void clock_init() {
+    write_byte(PIT_COMMAND, PIT_SELECT_CHANNEL0 | PIT_ACCESS_LOHI | PIT_MODE_RATE_GENERATOR);
+    write_byte(PIT_CHANNEL0, PIT_LATCH & 0xff);
+    write_byte(PIT_CHANNEL0, PIT_LATCH >> 8);
+
+    idt_install_irq_handler(pic_get_vector(PIT_IRQ), pit_irq_handler);
+    irq_clear_mask(PIT_IRQ);
+    clock_register(&pit_clocksource);
+
+    if (cpu_has_feature(CPU_FEATURE_TSC)) {
+        tsc_clocksource.freq_hz = calibrate_tsc();
+        if (tsc_clocksource.freq_hz) {
+            if (cpu_has_feature(CPU_FEATURE_INVARIANT_TSC)) {
+                tsc_clocksource.rating = RATING_TSC_INVARIANT;
+            }
+            clock_register(&tsc_clocksource);
+        }
+    }
+
+    uint32_t khz = tsc_clocksource.freq_hz / 1000;
+    println("Clock: using %s, TSC runs at %u.%03u MHz", source->name, khz / 1000, khz % 1000);
+}
@@ -0,0 +1,122 @@
+#ifndef _DREWOS_CLOCK_H_
+#define _DREWOS_CLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NSEC_PER_USEC 1000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+// Frequency of the periodic PIT interrupt (IRQ0).
+#define CLOCK_HZ 1000
+
+// A free-running counter which can be used to keep time.
+typedef struct {
+    const char *name;
+
+    // Read the counter.
+    uint64_t (*read)();
+
+    // Mask of the bits returned by read(). The counter wraps around to 0 after
+    // reaching this value.
+    uint64_t mask;
+
+    // Frequency of the counter.
+    uint32_t freq_hz;
+
+    // How good the counter is, relative to the others. The counter with the
+    // highest rating is used for ktime_ns().
+    uint16_t rating;
+
+    // Conversion from counter ticks to nanoseconds: ns = (ticks * mult) >>
+    // shift. These are set by clock_register().
+    uint32_t mult;
+    uint32_t shift;
+} clocksource_t;
+
+/*
+Start the periodic PIT interrupt, calibrate the TSC against the PIT, and select
+the best available clocksource. This must be called after idt_init() and
+pic_init().
+*/
+void clock_init();
+
+/*
+Register a clocksource. If it has a higher rating than the current clocksource,
+it's used from now on. Time remains monotonic across the switch.
+
+@param cs: The clocksource. This must remain valid forever.
+*/
+void clock_register(clocksource_t *cs);
+
+/*
+Measure the frequency of the TSC again, against the best clocksource other
+than the TSC and the PIT. Call this after registering more accurate
+clocksources, eg the HPET.
+*/
+void clock_calibrate_tsc();
+
+/*
+Get the clocksource currently used for ktime_ns().
+*/
+const clocksource_t *clock_get_source();
+
+/*
+Get the time in nanoseconds since clock_init(). This is monotonic, and may be
+called from any context.
+*/
+uint64_t ktime_ns();
+
+/*
+Get the number of PIT interrupts since clock_init(). After clock_stop_tick(),
+this carries on counting at CLOCK_HZ, from ktime_ns().
+*/
+uint64_t clock_get_ticks();
+
+/*
+Stop the periodic PIT interrupt, so that an idle CPU isn't woken CLOCK_HZ times
+a second. Return false if the tick can't be stopped because the PIT is the only
+clocksource.
+*/
+bool clock_stop_tick();
+
+/*
+Get the longest time for which the clock may go unread, or ~0 if there is no
+limit. A narrow counter, eg the ACPI PM timer, must be read before it wraps
+around.
+*/
+uint64_t clock_max_idle_ns();
+
+/*
+Wait for at least the specified number of microseconds. If the TSC is
+unavailable, the clocksource is driven by the PIT interrupt, in which case
+interrupts must be enabled.
+
+@param us: Number of microseconds to wait.
+*/
+void udelay(uint32_t us);
+
+/*
+Convert a number of ticks of a clocksource to nanoseconds.
+
+@param cs: The clocksource.
+@param ticks: The number of ticks.
+*/
+uint64_t clocksource_to_ns(const clocksource_t *cs, uint64_t ticks);
+
+/*
+Convert a number of TSC cycles to nanoseconds, eg to report the difference
+between two read_tsc() values in real time. Return 0 if the TSC has not been
+calibrated.
+
+@param cycles: The number of cycles.
+*/
+uint64_t tsc_to_ns(uint64_t cycles);
+
+/*
+Get the calibrated frequency of the TSC, or 0 if there is no TSC.
+*/
+uint32_t tsc_get_freq_hz();
+
+#endif // _DREWOS_CLOCK_H_
@@ -0,0 +1,191 @@
+#include <stdint.h>
+
+#include "convert.h"
+#include "dmath.h"
+
+// Largest power of 10 which fits in 32 bits. 64-bit numbers are converted in
+// chunks of this many decimal digits.
+#define CHUNK_DIGITS 9
+#define CHUNK_SIZE 1000000000u
+
+// The decimal representations of 0 - 99. Converting two digits per step halves
+// the number of divisions.
+static const char digit_pairs[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char digits[] = "0123456789abcdef";
+
+static const uint32_t powers_of_10[] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u,
+    1000000000u
+};
+
+/*
+Return the index of the most significant set bit in x. x must be non-zero.
+*/
+static inline uint32_t bsr(uint32_t x) {
+    uint32_t index;
+    __asm__("bsrl %1, %0" : "=r" (index) : "rm" (x));
+    return index;
+}
+
+/*
+Return log2(base) for a power-of-two base.
+*/
+static inline uint8_t get_shift(uint8_t base) {
+    switch (base) {
+        case 2:
+            return 1;
+        case 8:
+            return 3;
+        case 16:
+        default:
+            return 4;
+    }
+}
+
+uint32_t u32_ndigits(uint32_t x, uint8_t base) {
+    // Setting the lowest bit means zero takes 1 digit, and cannot change the
+    // result otherwise, as no power of 10 (other than 1) is odd.
+    uint32_t log2 = bsr(x | 1);
+
+    if (base == 10) {
+        // 1233 / 4096 approximates log10(2), so this is either the number of
+        // digits or one less than it.
+        uint32_t t = ((log2 + 1) * 1233) >> 12;
+        return t + ((x | 1) >= powers_of_10[t]);
+    }
+
+    return log2 / get_shift(base) + 1;
+}
+
+/*
+Write the decimal digits of x backwards from end.
+*/
+static char *write_decimal(uint32_t x, char *end) {
+    while (x >= 100) {
+        const char *pair = &digit_pairs[(x % 100) * 2];
+        x /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+
+    if (x >= 10) {
+        *--end = digit_pairs[x * 2 + 1];
+        *--end = digit_pairs[x * 2];
+    } else {
+        *--end = '0' + x;
+    }
+    return end;
+}
+
+/*
+Write exactly CHUNK_DIGITS decimal digits of x (which must be less than
+CHUNK_SIZE) backwards from end, with leading zeroes.
+*/
+static char *write_decimal_chunk(uint32_t x, char *end) {
+    for (uint8_t i = 0; i < CHUNK_DIGITS / 2; i++) {
+        const char *pair = &digit_pairs[(x % 100) * 2];
+        x /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    *--end = '0' + x;
+    return end;
+}
+
+/*
+Write the digits of x in a power-of-two base backwards from end.
+*/
+static void write_pow2(uint64_t x, uint8_t base, char *end) {
+    uint8_t shift = get_shift(base);
+    uint32_t mask = base - 1;
+    do {
+        *--end = digits[(uint32_t)x & mask];
+        x >>= shift;
+    } while (x);
+}
+
+uint32_t u32_to_str(uint32_t x, uint8_t base, char *buf, uint32_t bufsize) {
+    uint32_t n = u32_ndigits(x, base);
+    if (bufsize <= n) {
+        return 0;
+    }
+
+    buf[n] = '\0';
+    if (base == 10) {
+        write_decimal(x, buf + n);
+    } else {
+        write_pow2(x, base, buf + n);
+    }
+    return n;
+}
+
+uint32_t u64_to_str(uint64_t x, uint8_t base, char *buf, uint32_t bufsize) {
+    uint32_t high = (uint32_t)(x >> 32);
+    if (!high) {
+        return u32_to_str((uint32_t)x, base, buf, bufsize);
+    }
+
+    uint32_t n;
+    if (base == 10) {
+        // Split off the low-order digits in chunks which fit in 32 bits. At
+        // most two chunks are needed, as 2^64 < 10^20.
+        uint32_t chunks[2];
+        uint8_t nchunk = 0;
+        while (x >> 32) {
+            chunks[nchunk++] = div64_32(&x, CHUNK_SIZE);
+        }
+
+        n = u32_ndigits((uint32_t)x, 10) + nchunk * CHUNK_DIGITS;
+        if (bufsize <= n) {
+            return 0;
+        }
+
+        char *end = buf + n;
+        for (uint8_t i = 0; i < nchunk; i++) {
+            end = write_decimal_chunk(chunks[i], end);
+        }
+        write_decimal((uint32_t)x, end);
+    } else {
+        n = (32 + bsr(high)) / get_shift(base) + 1;
+        if (bufsize <= n) {
+            return 0;
+        }
+        write_pow2(x, base, buf + n);
+    }
+
+    buf[n] = '\0';
+    return n;
+}
+
+uint32_t i32_to_str(int32_t x, uint8_t base, char *buf, uint32_t bufsize) {
+    if (x >= 0) {
+        return u32_to_str(x, base, buf, bufsize);
+    }
+
+    // Negate as unsigned, so that INT32_MIN is handled correctly.
+    uint32_t n = bufsize > 1 ? u32_to_str(-(uint32_t)x, base, buf + 1, bufsize - 1) : 0;
+    if (!n) {
+        return 0;
+    }
+    buf[0] = '-';
+    return n + 1;
+}
+
+uint32_t i64_to_str(int64_t x, uint8_t base, char *buf, uint32_t bufsize) {
+    if (x >= 0) {
+        return u64_to_str(x, base, buf, bufsize);
+    }
+
+    uint32_t n = bufsize > 1 ? u64_to_str(-(uint64_t)x, base, buf + 1, bufsize - 1) : 0;
+    if (!n) {
+        return 0;
+    }
+    buf[0] = '-';
+    return n + 1;
+}
@@ -0,0 +1,53 @@
+#ifndef _DREWOS_CONVERT_H_
+#define _DREWOS_CONVERT_H_
+
+#include <stdint.h>
+
+// Size of a buffer large enough to hold any converted integer: 64 binary
+// digits, a minus sign and a NULL terminator.
+#define CONVERT_BUFSIZE 66
+
+/*
+Return the number of digits needed to represent x in the given base. Zero
+requires 1 digit.
+
+@param x: The number.
+@param base: The base (2, 8, 10 or 16).
+*/
+uint32_t u32_ndigits(uint32_t x, uint8_t base);
+
+/*
+Convert an unsigned 32-bit integer to a NULL-terminated string of digits in the
+given base. Hex digits are lowercase and no prefix is written.
+
+@param x: The number to convert.
+@param base: The base (2, 8, 10 or 16).
+@param buf: The output buffer.
+@param bufsize: Size of the output buffer, including space for the NULL
+terminator.
+
+@return The length of the string, or 0 if the buffer is too small (in which
+case nothing is written).
+*/
+uint32_t u32_to_str(uint32_t x, uint8_t base, char *buf, uint32_t bufsize);
+
+/*
+Convert a signed 32-bit integer to a NULL-terminated string in the given base.
+Negative numbers are written as a minus sign followed by the magnitude. See
+u32_to_str() for details.
+*/
+uint32_t i32_to_str(int32_t x, uint8_t base, char *buf, uint32_t bufsize);
+
+/*
+Convert an unsigned 64-bit integer to a NULL-terminated string of digits in the
+given base. See u32_to_str() for details.
+*/
+uint32_t u64_to_str(uint64_t x, uint8_t base, char *buf, uint32_t bufsize);
+
+/*
+Convert a signed 64-bit integer to a NULL-terminated string in the given base.
+See i32_to_str() for details.
+*/
+uint32_t i64_to_str(int64_t x, uint8_t base, char *buf, uint32_t bufsize);
+
+#endif // _DREWOS_CONVERT_H_
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpuid.h"
+
+// The ID bit of EFLAGS. If this bit can be modified, cpuid is supported.
+#define EFLAGS_ID (1 << 21)
+
+// Number of cached feature registers.
+#define NFEATURE_WORDS 4
+
+// First extended cpuid leaf.
+#define EXTENDED_LEAF_BASE 0x80000000
+
+// Extended leaf which reports advanced power management features.
+#define LEAF_ADVANCED_POWER_MANAGEMENT 0x80000007
+
+static uint32_t features[NFEATURE_WORDS];
+
+void cpuid(uint32_t leaf, uint32_t subleaf, cpuid_regs_t *regs) {
+    __asm__ volatile("cpuid"
+                     : "=a" (regs->eax), "=b" (regs->ebx), "=c" (regs->ecx), "=d" (regs->edx)
+                     : "a" (leaf), "c" (subleaf));
+}
+
+/*
+Return true iff the cpuid instruction is supported, by attempting to toggle the
+ID bit of EFLAGS.
+*/
+static bool cpuid_supported() {
+    uint32_t before, after;
+    __asm__ volatile("pushfl\n\t"
+                     "pushfl\n\t"
+                     "popl %0\n\t"
+                     "movl %0, %1\n\t"
+                     "xorl %2, %1\n\t"
+                     "pushl %1\n\t"
+                     "popfl\n\t"
+                     "pushfl\n\t"
+                     "popl %1\n\t"
+                     "popfl"
+                     : "=&r" (before), "=&r" (after)
+                     : "i" (EFLAGS_ID));
+    return (before ^ after) & EFLAGS_ID;
+}
+
+void cpuid_init() {
+    if (!cpuid_supported()) {
+        return;
+    }
+
+    cpuid_regs_t regs;
+    cpuid(0, 0, &regs);
+    uint32_t max_leaf = regs.eax;
+
+    cpuid(1, 0, &regs);
+    features[0] = regs.edx;
+    features[1] = regs.ecx;
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &regs);
+        features[2] = regs.ebx;
+    }
+
+    cpuid(EXTENDED_LEAF_BASE, 0, &regs);
+    if (regs.eax >= LEAF_ADVANCED_POWER_MANAGEMENT) {
+        cpuid(LEAF_ADVANCED_POWER_MANAGEMENT, 0, &regs);
+        features[3] = regs.edx;
+    }
+}
+
+bool cpu_has_feature(cpu_feature_t feature) {
+    return (features[feature >> 5] >> (feature & 0x1f)) & 1;
+}
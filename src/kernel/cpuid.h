@@ -0,0 +1,64 @@
+#ifndef _DREWOS_CPUID_H_
+#define _DREWOS_CPUID_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Registers returned by the cpuid instruction.
+typedef struct {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+} cpuid_regs_t;
+
+// Feature flags are encoded as (word << 5) | bit, where word selects one of the
+// feature registers cached by cpuid_init():
+// 0: leaf 1 edx
+// 1: leaf 1 ecx
+// 2: leaf 7 (subleaf 0) ebx
+// 3: leaf 0x80000007 edx
+#define CPU_FEATURE(word, bit) (((word) << 5) | (bit))
+
+typedef enum {
+    // x87 FPU on chip.
+    CPU_FEATURE_FPU           = CPU_FEATURE(0, 0),
+    // Time stamp counter (rdtsc).
+    CPU_FEATURE_TSC           = CPU_FEATURE(0, 4),
+    // Local APIC on chip.
+    CPU_FEATURE_APIC          = CPU_FEATURE(0, 9),
+    // fxsave/fxrstor.
+    CPU_FEATURE_FXSR          = CPU_FEATURE(0, 24),
+    CPU_FEATURE_SSE           = CPU_FEATURE(0, 25),
+    CPU_FEATURE_SSE2          = CPU_FEATURE(0, 26),
+    CPU_FEATURE_SSE3          = CPU_FEATURE(1, 0),
+    // monitor/mwait.
+    CPU_FEATURE_MONITOR       = CPU_FEATURE(1, 3),
+    // Local APIC timer supports TSC-deadline mode.
+    CPU_FEATURE_TSC_DEADLINE  = CPU_FEATURE(1, 24),
+    // Enhanced rep movsb/stosb.
+    CPU_FEATURE_ERMS          = CPU_FEATURE(2, 9),
+    // The TSC runs at a constant rate in all power states.
+    CPU_FEATURE_INVARIANT_TSC = CPU_FEATURE(3, 8)
+} cpu_feature_t;
+
+/*
+Execute the cpuid instruction.
+
+@param leaf: The leaf (value of eax).
+@param subleaf: The subleaf (value of ecx).
+@param regs: Receives the values of eax, ebx, ecx and edx.
+*/
+void cpuid(uint32_t leaf, uint32_t subleaf, cpuid_regs_t *regs);
+
+/*
+Query the CPU's feature flags. This must be called before cpu_has_feature().
+*/
+void cpuid_init();
+
+/*
+Check whether the CPU supports the specified feature.
+*/
+bool cpu_has_feature(cpu_feature_t feature);
+
+#endif // _DREWOS_CPUID_H_
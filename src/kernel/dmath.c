@@ -53,6 +53,37 @@ uint32_t ilog(uint32_t base, uint32_t x) {
     return result;
 }
 
+uint32_t div64_32(uint64_t *n, uint32_t divisor) {
+    uint32_t high = (uint32_t)(*n >> 32);
+    uint32_t low = (uint32_t)*n;
+    uint32_t remainder;
+
+    // Divide the high word first, so that the remainder is less than divisor.
+    // This guarantees that the quotient of the second division fits in 32 bits,
+    // which is a requirement of the div instruction.
+    uint32_t high_quotient = high / divisor;
+    high %= divisor;
+
+    // Divide edx:eax by the divisor.
+    __asm__("divl %2" : "=a" (low), "=d" (remainder) : "rm" (divisor), "0" (low), "1" (high));
+
+    *n = ((uint64_t)high_quotient << 32) | low;
+    return remainder;
+}
+
+uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t high = (uint32_t)(a >> 32);
+    uint32_t low = (uint32_t)a;
+
+    // Multiply each half separately. The high half's product is shifted left
+    // by 32 bits before the right shift, and the two cancel out exactly.
+    uint64_t result = ((uint64_t)low * mul) >> shift;
+    if (high) {
+        result += ((uint64_t)high * mul) << (32 - shift);
+    }
+    return result;
+}
+
 int32_t abs(int32_t x) {
     return x >= 0 ? x : -x;
 }
@@ -18,6 +18,25 @@ Return integer base raised to the power of exponent.
 */
 uint32_t ipow(uint32_t base, uint32_t exponent);
 
+/*
+Divide a 64-bit integer by a 32-bit divisor in place, and return the remainder.
+This avoids depending on libgcc for 64-bit division.
+
+@param n: The dividend. This is overwritten with the quotient.
+@param divisor: The divisor.
+*/
+uint32_t div64_32(uint64_t *n, uint32_t divisor);
+
+/*
+Return (a * mul) >> shift, without overflowing the 64-bit intermediate product
+and without depending on libgcc.
+
+@param a: The 64-bit multiplicand.
+@param mul: The 32-bit multiplier.
+@param shift: Number of bits to shift the product right by. Must be <= 32.
+*/
+uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift);
+
 /*
 Return the absolute value of an integer.
 */
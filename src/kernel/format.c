@@ -0,0 +1,358 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "format.h"
+#include "convert.h"
+
+// Flags which may precede a conversion.
+#define FLAG_LEFT 0x01
+#define FLAG_ZERO 0x02
+#define FLAG_PLUS 0x04
+#define FLAG_SPACE 0x08
+#define FLAG_ALT 0x10
+
+// Length modifiers.
+typedef enum {
+    LEN_CHAR,
+    LEN_SHORT,
+    LEN_INT,
+    LEN_LONG,
+    LEN_LONG_LONG
+} length_t;
+
+// A parsed conversion specification.
+typedef struct {
+    uint8_t flags;
+    int32_t width;
+
+    // Minimum number of digits (or maximum number of characters for %s), or -1
+    // if no precision was given.
+    int32_t precision;
+
+    length_t length;
+} spec_t;
+
+// Output state. Characters beyond the end of the buffer are counted but not
+// stored, so that the caller can learn the untruncated length.
+typedef struct {
+    char *buf;
+    uint32_t size;
+    uint32_t pos;
+} writer_t;
+
+static void put_char(writer_t *w, char c) {
+    if (w->pos + 1 < w->size) {
+        w->buf[w->pos] = c;
+    }
+    w->pos++;
+}
+
+static void put_chars(writer_t *w, const char *s, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        put_char(w, s[i]);
+    }
+}
+
+static void put_padding(writer_t *w, char c, int32_t n) {
+    for (; n > 0; n--) {
+        put_char(w, c);
+    }
+}
+
+/*
+Write a string of n characters, padded to the field width.
+*/
+static void put_field(writer_t *w, const spec_t *spec, const char *s, uint32_t n) {
+    int32_t pad = spec->width - (int32_t)n;
+    if (!(spec->flags & FLAG_LEFT)) {
+        put_padding(w, ' ', pad);
+    }
+    put_chars(w, s, n);
+    if (spec->flags & FLAG_LEFT) {
+        put_padding(w, ' ', pad);
+    }
+}
+
+/*
+Write an integer, given its magnitude and sign. The '+' and ' ' flags only
+apply to signed conversions.
+*/
+static void put_integer(writer_t *w, const spec_t *spec, uint64_t x, bool is_signed, bool negative, uint8_t base, bool upper) {
+    char digits[CONVERT_BUFSIZE];
+    uint32_t ndigit = u64_to_str(x, base, digits, CONVERT_BUFSIZE);
+
+    // Zero with a precision of 0 is printed as no digits at all.
+    if (!x && spec->precision == 0) {
+        ndigit = 0;
+    }
+
+    if (upper) {
+        for (uint32_t i = 0; i < ndigit; i++) {
+            if (digits[i] >= 'a') {
+                digits[i] -= 'a' - 'A';
+            }
+        }
+    }
+
+    int32_t precision = spec->precision < 0 ? 1 : spec->precision;
+    int32_t nzero = precision - (int32_t)ndigit;
+    if (nzero < 0) {
+        nzero = 0;
+    }
+
+    char prefix[3];
+    uint32_t npfx = 0;
+    if (negative) {
+        prefix[npfx++] = '-';
+    } else if (is_signed && (spec->flags & FLAG_PLUS)) {
+        prefix[npfx++] = '+';
+    } else if (is_signed && (spec->flags & FLAG_SPACE)) {
+        prefix[npfx++] = ' ';
+    }
+
+    if (spec->flags & FLAG_ALT) {
+        if (base == 16 && x) {
+            prefix[npfx++] = '0';
+            prefix[npfx++] = upper ? 'X' : 'x';
+        } else if (base == 2 && x) {
+            prefix[npfx++] = '0';
+            prefix[npfx++] = 'b';
+        } else if (base == 8 && nzero == 0 && (x || !ndigit)) {
+            // The alternate form of octal ensures there is a leading zero.
+            nzero = 1;
+        }
+    }
+
+    int32_t pad = spec->width - (int32_t)(npfx + nzero + ndigit);
+
+    // Zero padding goes between the prefix and the digits. It is ignored if a
+    // precision was given or the field is left-justified.
+    if ((spec->flags & FLAG_ZERO) && !(spec->flags & FLAG_LEFT) && spec->precision < 0) {
+        nzero += pad > 0 ? pad : 0;
+        pad = 0;
+    }
+
+    if (!(spec->flags & FLAG_LEFT)) {
+        put_padding(w, ' ', pad);
+    }
+    put_chars(w, prefix, npfx);
+    put_padding(w, '0', nzero);
+    put_chars(w, digits, ndigit);
+    if (spec->flags & FLAG_LEFT) {
+        put_padding(w, ' ', pad);
+    }
+}
+
+static int64_t get_signed(const spec_t *spec, va_list *args) {
+    switch (spec->length) {
+        case LEN_CHAR:
+            return (signed char)va_arg(*args, int);
+        case LEN_SHORT:
+            return (short)va_arg(*args, int);
+        case LEN_LONG:
+            return va_arg(*args, long);
+        case LEN_LONG_LONG:
+            return va_arg(*args, long long);
+        case LEN_INT:
+        default:
+            return va_arg(*args, int);
+    }
+}
+
+static uint64_t get_unsigned(const spec_t *spec, va_list *args) {
+    switch (spec->length) {
+        case LEN_CHAR:
+            return (unsigned char)va_arg(*args, unsigned int);
+        case LEN_SHORT:
+            return (unsigned short)va_arg(*args, unsigned int);
+        case LEN_LONG:
+            return va_arg(*args, unsigned long);
+        case LEN_LONG_LONG:
+            return va_arg(*args, unsigned long long);
+        case LEN_INT:
+        default:
+            return va_arg(*args, unsigned int);
+    }
+}
+
+/*
+Parse a decimal number (or '*') from the format string.
+*/
+static int32_t parse_number(const char **fmt, va_list *args) {
+    if (**fmt == '*') {
+        (*fmt)++;
+        return va_arg(*args, int);
+    }
+
+    int32_t n = 0;
+    while (**fmt >= '0' && **fmt <= '9') {
+        n = n * 10 + (*(*fmt)++ - '0');
+    }
+    return n;
+}
+
+/*
+Parse the flags, width, precision and length of a conversion specification.
+On return, fmt points to the conversion character.
+*/
+static void parse_spec(const char **fmt, spec_t *spec, va_list *args) {
+    spec->flags = 0;
+    for (;; (*fmt)++) {
+        switch (**fmt) {
+            case '-':
+                spec->flags |= FLAG_LEFT;
+                continue;
+            case '0':
+                spec->flags |= FLAG_ZERO;
+                continue;
+            case '+':
+                spec->flags |= FLAG_PLUS;
+                continue;
+            case ' ':
+                spec->flags |= FLAG_SPACE;
+                continue;
+            case '#':
+                spec->flags |= FLAG_ALT;
+                continue;
+        }
+        break;
+    }
+
+    // A negative width read from the arguments means left-justify.
+    spec->width = parse_number(fmt, args);
+    if (spec->width < 0) {
+        spec->flags |= FLAG_LEFT;
+        spec->width = -spec->width;
+    }
+
+    spec->precision = -1;
+    if (**fmt == '.') {
+        (*fmt)++;
+        spec->precision = parse_number(fmt, args);
+        if (spec->precision < 0) {
+            spec->precision = -1;
+        }
+    }
+
+    spec->length = LEN_INT;
+    if (**fmt == 'h') {
+        (*fmt)++;
+        spec->length = LEN_SHORT;
+        if (**fmt == 'h') {
+            (*fmt)++;
+            spec->length = LEN_CHAR;
+        }
+    } else if (**fmt == 'l') {
+        (*fmt)++;
+        spec->length = LEN_LONG;
+        if (**fmt == 'l') {
+            (*fmt)++;
+            spec->length = LEN_LONG_LONG;
+        }
+    } else if (**fmt == 'z') {
+        // size_t is 32 bits wide.
+        (*fmt)++;
+        spec->length = LEN_INT;
+    }
+}
+
+uint32_t kvsnprintf(char *buf, uint32_t size, const char *fmt, va_list args) {
+    writer_t w = { buf, size, 0 };
+    spec_t spec;
+    va_list ap;
+
+    // Copy the argument list so that it can be passed around by pointer.
+    va_copy(ap, args);
+
+    char c;
+    while ( (c = *fmt++) ) {
+        if (c != '%') {
+            put_char(&w, c);
+            continue;
+        }
+
+        parse_spec(&fmt, &spec, &ap);
+
+        int64_t var_int;
+        char var_char;
+        const char *var_str;
+
+        switch ( (c = *fmt++) ) {
+            case '%':
+                // %% - Literal % character.
+                put_char(&w, '%');
+                break;
+            case 'c':
+                // %c - A single character.
+                var_char = (char)va_arg(ap, int);
+                put_field(&w, &spec, &var_char, 1);
+                break;
+            case 's':
+                // %s - A string, of at most precision characters.
+                var_str = va_arg(ap, const char *);
+                if (!var_str) {
+                    var_str = "(null)";
+                }
+                uint32_t len = 0;
+                while (var_str[len] && (spec.precision < 0 || len < (uint32_t)spec.precision)) {
+                    len++;
+                }
+                put_field(&w, &spec, var_str, len);
+                break;
+            case 'd':
+            case 'i':
+                // %d - A signed decimal integer.
+                var_int = get_signed(&spec, &ap);
+                put_integer(&w, &spec, var_int < 0 ? -(uint64_t)var_int : (uint64_t)var_int, true, var_int < 0, 10, false);
+                break;
+            case 'u':
+                // %u - An unsigned decimal integer.
+                put_integer(&w, &spec, get_unsigned(&spec, &ap), false, false, 10, false);
+                break;
+            case 'x':
+            case 'X':
+                // %x - An unsigned hexadecimal integer.
+                put_integer(&w, &spec, get_unsigned(&spec, &ap), false, false, 16, c == 'X');
+                break;
+            case 'o':
+                // %o - An unsigned octal integer.
+                put_integer(&w, &spec, get_unsigned(&spec, &ap), false, false, 8, false);
+                break;
+            case 'b':
+                // %b - An unsigned binary integer.
+                put_integer(&w, &spec, get_unsigned(&spec, &ap), false, false, 2, false);
+                break;
+            case 'p':
+                // %p - A pointer, printed in hex with a 0x prefix.
+                spec.flags |= FLAG_ALT;
+                spec.length = LEN_INT;
+                put_integer(&w, &spec, (uintptr_t)va_arg(ap, void *), false, false, 16, false);
+                break;
+            case '\0':
+                // A lone % at the end of the format string.
+                fmt--;
+                break;
+            default:
+                // Unknown conversion - print it verbatim.
+                put_char(&w, '%');
+                put_char(&w, c);
+                break;
+        }
+    }
+
+    va_end(ap);
+
+    if (size) {
+        buf[w.pos < size ? w.pos : size - 1] = '\0';
+    }
+    return w.pos;
+}
+
+uint32_t ksnprintf(char *buf, uint32_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    uint32_t len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,39 @@
+#ifndef _DREWOS_FORMAT_H_
+#define _DREWOS_FORMAT_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/*
+Format a string into a caller-supplied buffer, in the style of vsnprintf().
+
+The following conversions are supported: %c %s %d %i %u %x %X %o %b %p %%. Each
+conversion may be given flags ('-', '0', '+', ' ', '#'), a field width, a
+precision, and a length modifier (hh, h, l, ll, z). Width and precision may be
+given as '*', in which case they are read from the arguments.
+
+The output is always NULL-terminated, unless size is 0. If the buffer is too
+small, the output is truncated.
+
+@param buf: The output buffer.
+@param size: Size of the output buffer in bytes.
+@param fmt: The format string.
+@param args: Arguments referenced by the format string.
+
+@return The length of the fully-formatted string, excluding the NULL
+terminator. If this is >= size, the output has been truncated.
+*/
+uint32_t kvsnprintf(char *buf, uint32_t size, const char *fmt, va_list args);
+
+/*
+Format a string into a caller-supplied buffer, in the style of snprintf(). See
+kvsnprintf() for details.
+
+@param buf: The output buffer.
+@param size: Size of the output buffer in bytes.
+@param fmt: The format string.
+@param ...: Arguments referenced by the format string.
+*/
+uint32_t ksnprintf(char *buf, uint32_t size, const char *fmt, ...);
+
+#endif // _DREWOS_FORMAT_H_
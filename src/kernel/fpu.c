@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpu.h"
+#include "cpuid.h"
+#include "idt.h"
+#include "low_level.h"
+#include "vga.h"
+
+// CR0 bits.
+
+// Monitor coprocessor. With TS, makes wait/fwait raise #NM.
+#define CR0_MP (1 << 1)
+
+// Emulation. If set, all FPU instructions raise #NM.
+#define CR0_EM (1 << 2)
+
+// Task switched. If set, the next FPU/SSE instruction raises #NM.
+#define CR0_TS (1 << 3)
+
+// Native FPU error reporting via #MF, rather than the legacy IRQ13.
+#define CR0_NE (1 << 5)
+
+// CR4 bits.
+
+// OS supports fxsave/fxrstor, which also enables SSE instructions.
+#define CR4_OSFXSR (1 << 9)
+
+// OS supports unmasked SIMD floating-point exceptions (#XM).
+#define CR4_OSXMMEXCPT (1 << 10)
+
+// Device-not-available exception vector.
+#define VECTOR_NM 7
+
+// Power-on value of MXCSR: all SIMD floating-point exceptions masked.
+#define MXCSR_DEFAULT 0x1f80
+
+static bool has_fxsr = false;
+
+// The context which was running when fpu_init() was called.
+static fpu_context_t kernel_context;
+
+// Register state immediately after initialisation. This is loaded the first
+// time a context uses the FPU.
+static fpu_context_t initial_context;
+
+// The context which is currently running.
+static fpu_context_t *current = &kernel_context;
+
+// The context whose state is currently held in the FPU registers, or NULL if
+// they were last used by kernel_fpu_begin(), and hold no context's state.
+static fpu_context_t *owner = &kernel_context;
+
+static void save(fpu_context_t *ctx) {
+    if (has_fxsr) {
+        __asm__ volatile("fxsave %0" : "=m" (ctx->state));
+    } else {
+        // Note that fnsave also reinitialises the FPU.
+        __asm__ volatile("fnsave %0" : "=m" (ctx->state));
+    }
+}
+
+static void restore(fpu_context_t *ctx) {
+    if (has_fxsr) {
+        __asm__ volatile("fxrstor %0" : : "m" (ctx->state));
+    } else {
+        __asm__ volatile("frstor %0" : : "m" (ctx->state));
+    }
+}
+
+/*
+Handler for the device-not-available exception, which is raised when the
+running context executes an FPU/SSE instruction while CR0.TS is set. Save the
+state of the previous owner, and load the state of the running context.
+*/
+static void fpu_nm_handler(interrupt_frame_t *frame) {
+    (void)frame;
+
+    // Allow FPU instructions again.
+    __asm__ volatile("clts");
+
+    if (owner == current) {
+        return;
+    }
+
+    if (owner) {
+        save(owner);
+    }
+    restore(current->used ? current : &initial_context);
+    current->used = true;
+    owner = current;
+}
+
+void fpu_init() {
+    if (!cpu_has_feature(CPU_FEATURE_FPU)) {
+        println("No FPU present");
+        return;
+    }
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    __asm__ volatile("fninit");
+
+    has_fxsr = cpu_has_feature(CPU_FEATURE_FXSR);
+    if (has_fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (cpu_has_feature(CPU_FEATURE_SSE)) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    if (cpu_has_feature(CPU_FEATURE_SSE)) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        __asm__ volatile("ldmxcsr %0" : : "m" (mxcsr));
+    }
+
+    save(&initial_context);
+
+    kernel_context.used = true;
+    current = owner = &kernel_context;
+
+    idt_set_handler(VECTOR_NM, fpu_nm_handler);
+}
+
+void fpu_context_init(fpu_context_t *ctx) {
+    ctx->used = false;
+}
+
+void fpu_switch(fpu_context_t *ctx) {
+    current = ctx;
+
+    // If the context already owns the FPU registers, no trap is needed.
+    uint32_t cr0 = read_cr0();
+    if (ctx == owner) {
+        cr0 &= ~CR0_TS;
+    } else {
+        cr0 |= CR0_TS;
+    }
+    write_cr0(cr0);
+}
+
+bool kernel_fpu_begin() {
+    if (!has_fxsr) {
+        return false;
+    }
+
+    __asm__ volatile("clts");
+    if (owner) {
+        save(owner);
+        owner = 0;
+    }
+    return true;
+}
+
+void kernel_fpu_end() {
+    // No context owns the registers now, so make the next FPU instruction
+    // trap.
+    write_cr0(read_cr0() | CR0_TS);
+}
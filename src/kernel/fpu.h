@@ -0,0 +1,71 @@
+#ifndef _DREWOS_FPU_H_
+#define _DREWOS_FPU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of the area written by fxsave.
+#define FPU_STATE_SIZE 512
+
+// Saved x87/SSE register state of one execution context. fxsave requires the
+// area to be 16-byte aligned.
+typedef struct {
+    uint8_t state[FPU_STATE_SIZE];
+
+    // True once the context has used the FPU, and therefore has state worth
+    // restoring.
+    bool used;
+} __attribute__((aligned(16))) fpu_context_t;
+
+/*
+Initialise the x87 FPU, and enable SSE if the CPU supports it. This also
+installs the device-not-available (#NM) handler, so it must be called after
+idt_init().
+
+The code which is running when this is called becomes the kernel's initial FPU
+context.
+*/
+void fpu_init();
+
+/*
+Initialise an FPU context for a new execution context. The context's registers
+are set to their power-on values the first time it uses the FPU.
+
+@param ctx: The context.
+*/
+void fpu_context_init(fpu_context_t *ctx);
+
+/*
+Switch to a different FPU context. This should be called on every switch
+between execution contexts.
+
+Nothing is saved or restored here. Instead, CR0.TS is set, so that the next FPU
+or SSE instruction raises #NM, and the state is switched by the #NM handler.
+Contexts which never touch the FPU therefore never pay for saving or restoring
+it.
+
+@param ctx: The context being switched to.
+*/
+void fpu_switch(fpu_context_t *ctx);
+
+/*
+Claim the FPU/SSE registers for kernel code which runs outside of any FPU
+context, such as memcpy(). The state of the context which owns the registers is
+saved first, and is restored by the #NM handler the next time the running
+context uses the FPU. Return false if the registers can't be saved, in which
+case the caller mustn't touch them.
+
+Interrupts must be disabled until kernel_fpu_end() is called, since interrupt
+handlers may claim the registers too, and nothing saves them on interrupt
+entry.
+*/
+bool kernel_fpu_begin();
+
+/*
+Release the FPU/SSE registers claimed by kernel_fpu_begin(). The registers are
+left holding garbage, so the next FPU instruction of the running context raises
+#NM, which reloads its state.
+*/
+void kernel_fpu_end();
+
+#endif // _DREWOS_FPU_H_
@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "idle.h"
+#include "apic.h"
+#include "clock.h"
+#include "cpuid.h"
+#include "dmath.h"
+#include "idt.h"
+#include "klog.h"
+#include "timer.h"
+#include "vga.h"
+
+#define MAX_IDLE_POLLS 8
+
+// Length of a tick of clock_get_ticks().
+#define TICK_NS (NSEC_PER_SEC / CLOCK_HZ)
+
+static idle_poll_t polls[MAX_IDLE_POLLS];
+static uint8_t npolls = 0;
+
+// Whether the CPU waits with MWAIT rather than HLT.
+static bool use_mwait = false;
+
+// Whether the periodic tick has been stopped, in which case the local APIC
+// timer is armed for the next timer before going to sleep.
+static bool tickless = false;
+
+// Set by idle_wake(). This is also the address monitored by MWAIT, so writing
+// to it wakes the CPU.
+static volatile bool wake_pending = false;
+
+static idle_stats_t stats;
+
+static void apic_timer_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    stats.timer_wakeups++;
+    apic_send_eoi();
+}
+
+void idle_init() {
+    npolls = 0;
+    wake_pending = false;
+    stats.sleeps = 0;
+    stats.timer_wakeups = 0;
+    stats.idle_ns = 0;
+    stats.start_ns = 0;
+
+    use_mwait = cpu_has_feature(CPU_FEATURE_MONITOR);
+
+    // Without the PIT tick, the CPU is only woken by the local APIC timer when
+    // the next timer is due.
+    tickless = false;
+    if (apic_timer_init()) {
+        idt_set_handler(APIC_TIMER_VECTOR, apic_timer_handler);
+        tickless = clock_stop_tick();
+    }
+
+    println("Idle: waiting with %s, %s", use_mwait ? "mwait" : "hlt", tickless ? "tickless" : "periodic tick");
+}
+
+bool idle_add_poll(idle_poll_t poll) {
+    if (npolls >= MAX_IDLE_POLLS) {
+        return false;
+    }
+    polls[npolls++] = poll;
+    return true;
+}
+
+void idle_wake() {
+    wake_pending = true;
+}
+
+/*
+Arm the local APIC timer to wake the CPU when the next timer expires. Return
+false if a timer has already expired, in which case the CPU mustn't sleep.
+*/
+static bool arm_wakeup() {
+    uint64_t next = timer_next_expiry();
+    uint64_t now = clock_get_ticks();
+    if (next <= now) {
+        return false;
+    }
+
+    uint64_t delta = next - now;
+    uint64_t ns = delta < ~0ull / TICK_NS ? delta * TICK_NS : ~0ull;
+
+    // Wake up in time to read a narrow clocksource before it wraps around.
+    uint64_t max_ns = clock_max_idle_ns();
+    if (ns > max_ns) {
+        ns = max_ns;
+    }
+
+    if (ns == ~0ull) {
+        apic_timer_cancel();
+    } else {
+        apic_timer_arm(ns);
+    }
+    return true;
+}
+
+/*
+Sleep until the next interrupt, unless there's work to do. Interrupts must be
+enabled, and are enabled again on return.
+*/
+static void wait_for_interrupt() {
+    __asm__ volatile("cli" : : : "memory");
+
+    // Anything queued by an interrupt handler since the loop last ran would
+    // otherwise wait until the next unrelated interrupt.
+    if (wake_pending || klog_pending() || (tickless && !arm_wakeup())) {
+        __asm__ volatile("sti" : : : "memory");
+        return;
+    }
+
+    uint64_t start = ktime_ns();
+
+    // STI only takes effect after the next instruction, so no interrupt can
+    // arrive between checking for work and going to sleep.
+    if (use_mwait) {
+        __asm__ volatile("monitor" : : "a"(&wake_pending), "c"(0), "d"(0));
+        if (wake_pending) {
+            __asm__ volatile("sti" : : : "memory");
+        } else {
+            __asm__ volatile("sti; mwait" : : "a"(0), "c"(0) : "memory");
+        }
+    } else {
+        __asm__ volatile("sti; hlt" : : : "memory");
+    }
+
+    stats.sleeps++;
+    stats.idle_ns += ktime_ns() - start;
+}
+
+void idle_loop() {
+    stats.start_ns = ktime_ns();
+
+    for (;;) {
+        wake_pending = false;
+
+        timer_run();
+
+        bool busy = false;
+        for (uint8_t i = 0; i < npolls; i++) {
+            busy |= polls[i]();
+        }
+
+        klog_drain();
+
+        if (!busy) {
+            wait_for_interrupt();
+        }
+    }
+}
+
+const idle_stats_t *idle_get_stats() {
+    return &stats;
+}
+
+void idle_print_stats() {
+    uint64_t total_ms = ktime_ns() - stats.start_ns;
+    div64_32(&total_ms, NSEC_PER_MSEC);
+
+    uint64_t percent = stats.idle_ns;
+    div64_32(&percent, NSEC_PER_MSEC);
+    percent *= 100;
+    if (total_ms) {
+        div64_32(&percent, (uint32_t)total_ms);
+    }
+
+    println("Idle: %llu%% of %llu ms, %llu sleeps, %llu timer wakeups", percent, total_ms, stats.sleeps, stats.timer_wakeups);
+}
@@ -0,0 +1,65 @@
+#ifndef _DREWOS_IDLE_H_
+#define _DREWOS_IDLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A function called by the idle loop every time the CPU wakes up, eg to
+// process input queued by an interrupt handler. Return true if there is more
+// work to do, in which case the CPU doesn't go back to sleep.
+typedef bool (*idle_poll_t)();
+
+// Time spent asleep by the idle loop.
+typedef struct {
+    // Number of times the CPU went to sleep.
+    uint64_t sleeps;
+
+    // Number of times the CPU was woken by the local APIC timer.
+    uint64_t timer_wakeups;
+
+    // Total time spent asleep.
+    uint64_t idle_ns;
+
+    // Time at which the idle loop was started.
+    uint64_t start_ns;
+} idle_stats_t;
+
+/*
+Choose how the CPU waits for interrupts, and stop the periodic tick if the
+local APIC timer can be used to wake the CPU for the next timer instead. This
+must be called after pic_switch_to_apic() and timers_init().
+*/
+void idle_init();
+
+/*
+Run expired timers, poll functions and the kernel log, and sleep until the next
+interrupt whenever there's nothing to do. This never returns.
+*/
+void idle_loop();
+
+/*
+Register a function to be called every time the idle loop wakes up. Return
+false if too many functions are already registered.
+
+@param poll: The function.
+*/
+bool idle_add_poll(idle_poll_t poll);
+
+/*
+Stop the CPU from going to sleep until the idle loop has run again. Interrupt
+handlers which leave work for a poll function should call this, in case the
+CPU was just about to go to sleep.
+*/
+void idle_wake();
+
+/*
+Get the idle statistics of this CPU.
+*/
+const idle_stats_t *idle_get_stats();
+
+/*
+Print the proportion of time for which this CPU has been idle.
+*/
+void idle_print_stats();
+
+#endif // _DREWOS_IDLE_H_
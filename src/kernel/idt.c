@@ -3,9 +3,19 @@
 #include "idt.h"
 #include "vga.h"
 #include "pic.h"
+#include "klog.h"
+#include "clock.h"
+#include "dmath.h"
+#include "low_level.h"
+#include "serial.h"
 
 #define MAX_DESCRIPTORS 256
 
+// Exceptions which are safe to return from without a handler.
+#define VECTOR_DEBUG 1
+#define VECTOR_NMI 2
+#define VECTOR_BREAKPOINT 3
+
 #define IDT_DESCRIPTOR_X16_INTERRUPT	0x06
 #define IDT_DESCRIPTOR_X16_TRAP 		0x07
 #define IDT_DESCRIPTOR_X32_TASK 		0x05
@@ -25,12 +35,10 @@ __attribute__((aligned(0x10)))
 static idt_entry_t idt[MAX_DESCRIPTORS];
 
 static idtr_t idtr;
-extern void *isr_stub_table[];
-extern void generic_isr_stub(); // interrupts.asm
-
-void *handlers[MAX_DESCRIPTORS];
+extern void *isr_stub_table[]; // interrupts.asm
 
-void generic_handler(uint32_t vector);
+static interrupt_handler_t handlers[MAX_DESCRIPTORS];
+static interrupt_stats_t stats[MAX_DESCRIPTORS];
 
 void idt_set_descriptor(uint8_t vector, void *isr, uint8_t flags) {
     idt_entry_t *descriptor = &idt[vector];
@@ -49,9 +57,13 @@ void idt_init() {
     idtr.base = (uintptr_t)&idt[0];
     idtr.limit = (uint16_t)sizeof(idt_entry_t) * MAX_DESCRIPTORS - 1;
 
-    for (uint8_t vector = 0; vector < 32; vector++) {
-        void *isr = (vector != 8 && vector != 10 && vector != 11 && vector != 12 && vector != 13 && vector != 14 && vector != 17) ? (void *)(uintptr_t)generic_handler : isr_stub_table[vector];
-        idt_set_descriptor(vector, isr, 0x8e);
+    // Every vector goes through its own stub to isr_dispatch(), which looks up
+    // the handler.
+    for (uint16_t vector = 0; vector < MAX_DESCRIPTORS; vector++) {
+        handlers[vector] = 0;
+        stats[vector].hits = 0;
+        stats[vector].cycles = 0;
+        idt_set_descriptor(vector, isr_stub_table[vector], IDT_DESCRIPTOR_EXCEPTION);
     }
 
     // Load the new IDT.
@@ -61,34 +73,91 @@ void idt_init() {
     __asm__ volatile ("sti");
 }
 
-void idt_install_irq_handler(uint8_t vector, void (*handler)()) {
-    handlers[vector] = (void *)(uintptr_t)handler;
-    idt_set_descriptor(vector, (void *)(uintptr_t)generic_isr_stub, IDT_DESCRIPTOR_EXTERNAL);
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+void idt_install_irq_handler(uint8_t vector, interrupt_handler_t handler) {
+    idt_set_handler(vector, handler);
 }
 
 void idt_uninstall_irq_handler(uint8_t vector) {
-    // idt_set_descriptor(vector, isr_stub_table[vector], IDT_DESCRIPTOR_EXTERNAL);
-    handlers[vector] = 0;
+    idt_set_handler(vector, 0);
+}
+
+const interrupt_stats_t *idt_get_stats(uint8_t vector) {
+    return &stats[vector];
 }
 
-void generic_handler(uint32_t vector) {
-    uint16_t isr = pic_get_isr();
-    uint16_t irr = pic_get_irr();
-    println("INTERRUPT %d (%x), isr = %x, irr = %x", vector, vector, isr, irr);
-    if (handlers[vector] != 0) {
-        println("A handler has been attached to vector %x and will be invoked.");
-        void (*handler)() = (void (*)())(uintptr_t)handlers[vector];
-        handler();
+void idt_print_stats() {
+    println("%6s %10s %12s %10s", "vector", "hits", "total (us)", "ns/hit");
+    for (uint16_t vector = 0; vector < MAX_DESCRIPTORS; vector++) {
+        const interrupt_stats_t *s = &stats[vector];
+        if (s->hits == 0) {
+            continue;
+        }
+        uint64_t ns = tsc_to_ns(s->cycles);
+        uint64_t average = ns;
+        div64_32(&average, s->hits);
+        div64_32(&ns, NSEC_PER_USEC);
+        println("%#6x %10u %12llu %10llu", vector, s->hits, ns, average);
     }
-    // switch (vector) {
-    //     case 0x21: // IRQ1 - Keyboard
-    //         keyboard_handler();
-    //         break;
-    //     case 0x20: // IRQ0 - Timer
-    //         timer_handler();
-    //         break;
-    //     default:
-    //         printf("Unhandled interrupt: %d\n", vector);
-    //         break;
-    // }
+}
+
+/*
+Report an exception which has no handler, and halt. Returning would re-execute
+the faulting instruction, which would fault again.
+*/
+static void fatal_exception(interrupt_frame_t *frame) {
+    cprintln("Unhandled exception %u (error code %#x) at %#x:%#x, eflags = %#x", RED, BLACK,
+             frame->vector, frame->error_code, frame->cs, frame->eip, frame->eflags);
+    cprintln("eax = %#010x ebx = %#010x ecx = %#010x edx = %#010x", RED, BLACK,
+             frame->eax, frame->ebx, frame->ecx, frame->edx);
+    cprintln("esi = %#010x edi = %#010x ebp = %#010x esp = %#010x", RED, BLACK,
+             frame->esi, frame->edi, frame->ebp, frame->esp);
+
+    // Interrupts stay disabled from here on, so the serial port must be
+    // polled to get the message out.
+    serial_flush();
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+static void unhandled(interrupt_frame_t *frame) {
+    uint8_t vector = frame->vector;
+
+    // Exceptions other than NMI and the debug traps can't be returned from.
+    if (vector < 32 && vector != VECTOR_DEBUG && vector != VECTOR_NMI && vector != VECTOR_BREAKPOINT) {
+        fatal_exception(frame);
+    }
+    klog(LOG_DEBUG, "INTERRUPT %d (%#x), isr = %#x, irr = %#x", vector, vector, pic_get_isr(), pic_get_irr());
+}
+
+/*
+Called by isr_common (interrupts.asm) for every interrupt, with interrupts
+disabled.
+*/
+void isr_dispatch(interrupt_frame_t *frame) {
+    uint64_t start = read_tsc();
+    uint8_t vector = frame->vector;
+
+    int16_t irq = pic_get_irq(vector);
+    if (irq >= 0 && pic_is_spurious(irq)) {
+        return;
+    }
+
+    interrupt_handler_t handler = handlers[vector];
+    if (handler) {
+        handler(frame);
+    } else {
+        unhandled(frame);
+    }
+
+    if (irq >= 0) {
+        pic_send_eoi(irq);
+    }
+
+    stats[vector].hits++;
+    stats[vector].cycles += read_tsc() - start;
 }
@@ -27,11 +27,74 @@ typedef struct {
     uint32_t base;
 } __attribute__((packed)) idtr_t;
 
+// Register state saved on entry to an interrupt, in the order in which it is
+// pushed onto the stack (see interrupts.asm).
+typedef struct {
+    // Pushed by pusha. esp is the value before pusha.
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+
+    // Pushed by the vector's stub.
+    uint32_t vector;
+
+    // Pushed by the CPU for some exceptions, or 0.
+    uint32_t error_code;
+
+    // Pushed by the CPU.
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} __attribute__((packed)) interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
+
+// Number of times a vector has been raised, and time spent handling it.
+typedef struct {
+    uint32_t hits;
+
+    // Time-stamp counter cycles spent in the handler, including EOI.
+    uint64_t cycles;
+} interrupt_stats_t;
+
 void idt_set_descriptor(uint8_t vector, void *isr, uint8_t flags);
 
-void idt_install_irq_handler(uint8_t vector, void (*handler)());
+/*
+Set the handler which is called when the specified vector is raised.
+
+@param vector: The interrupt vector.
+@param handler: The handler, or 0 to remove the current handler.
+*/
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler);
+
+/*
+Set the handler for a hardware IRQ. The end-of-interrupt is sent automatically
+after the handler returns.
+
+@param vector: The interrupt vector to which the IRQ is mapped.
+@param handler: The handler.
+*/
+void idt_install_irq_handler(uint8_t vector, interrupt_handler_t handler);
 void idt_uninstall_irq_handler(uint8_t vector);
 
+/*
+Get the number of times the specified vector has been raised, and the time
+spent handling it.
+
+@param vector: The interrupt vector.
+*/
+const interrupt_stats_t *idt_get_stats(uint8_t vector);
+
+/*
+Print the statistics of every vector which has been raised at least once.
+*/
+void idt_print_stats();
+
 void idt_init();
 
 #endif // _DREWOS_IDT_H_
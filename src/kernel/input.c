@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "input.h"
+#include "clock.h"
+#include "dmath.h"
+#include "low_level.h"
+#include "vga.h"
+
+#define MAX_INPUT_CONSUMERS 4
+
+static input_consumer_t *consumers[MAX_INPUT_CONSUMERS];
+static uint8_t nconsumers = 0;
+
+static uint32_t latency[INPUT_LATENCY_BUCKETS];
+
+void input_init() {
+    nconsumers = 0;
+    for (uint8_t i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        latency[i] = 0;
+    }
+}
+
+bool input_register(input_consumer_t *consumer, input_event_t *buf, uint32_t size) {
+    if (nconsumers >= MAX_INPUT_CONSUMERS) {
+        return false;
+    }
+
+    consumer->buf = buf;
+    consumer->size = size;
+    consumer->head = 0;
+    consumer->tail = 0;
+    consumer->dropped = 0;
+    consumer->group = 0;
+    consumer->group_dropped = 0;
+    consumer->last_group = 0;
+    consumer->last_mergeable = false;
+    consumers[nconsumers++] = consumer;
+    return true;
+}
+
+void input_report(uint64_t timestamp, input_type_t type, uint16_t code, int32_t value) {
+    // Drivers and consumers both run in the idle loop, so the queues need no
+    // locking.
+    for (uint8_t i = 0; i < nconsumers; i++) {
+        input_consumer_t *consumer = consumers[i];
+        if (consumer->head - consumer->tail >= consumer->size) {
+            consumer->dropped++;
+            continue;
+        }
+
+        input_event_t *event = &consumer->buf[consumer->head & (consumer->size - 1)];
+        event->timestamp = timestamp;
+        event->type = type;
+        event->code = code;
+        event->value = value;
+        consumer->head++;
+    }
+}
+
+static input_event_t *get_event(input_consumer_t *consumer, uint32_t pos) {
+    return &consumer->buf[pos & (consumer->size - 1)];
+}
+
+/*
+Check whether the events from start to end are all movement.
+*/
+static bool is_movement(input_consumer_t *consumer, uint32_t start, uint32_t end) {
+    for (uint32_t pos = start; pos != end; pos++) {
+        if (get_event(consumer, pos)->type != INPUT_REL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Find the event for an axis in the group of movement from start to end.
+*/
+static input_event_t *find_axis(input_consumer_t *consumer, uint32_t start, uint32_t end, uint16_t code) {
+    for (uint32_t pos = start; pos != end; pos++) {
+        input_event_t *event = get_event(consumer, pos);
+        if (event->code == code) {
+            return event;
+        }
+    }
+    return 0;
+}
+
+/*
+Merge the group being reported, which has just been ended with INPUT_SYN, into
+the previous group. Return false, leaving both unchanged, if the previous group
+doesn't have an event for every axis in this one.
+*/
+static bool merge_group(input_consumer_t *consumer) {
+    uint32_t last = consumer->last_group;
+    uint32_t group = consumer->group;
+
+    // Both groups end with an INPUT_SYN event.
+    for (uint32_t pos = group; pos != consumer->head - 1; pos++) {
+        if (!find_axis(consumer, last, group - 1, get_event(consumer, pos)->code)) {
+            return false;
+        }
+    }
+
+    for (uint32_t pos = group; pos != consumer->head; pos++) {
+        input_event_t *event = get_event(consumer, pos);
+        input_event_t *into = event->type == INPUT_SYN ? get_event(consumer, group - 1) : find_axis(consumer, last, group - 1, event->code);
+        into->timestamp = event->timestamp;
+        into->value += event->value;
+    }
+
+    consumer->head = group;
+    return true;
+}
+
+void input_sync(uint64_t timestamp) {
+    input_report(timestamp, INPUT_SYN, 0, 0);
+
+    for (uint8_t i = 0; i < nconsumers; i++) {
+        input_consumer_t *consumer = consumers[i];
+
+        // A group which lost events can't be merged, in either direction.
+        bool complete = consumer->dropped == consumer->group_dropped;
+        bool movement = complete && is_movement(consumer, consumer->group, consumer->head - 1);
+
+        // The previous group can only be changed if the consumer hasn't
+        // started reading it.
+        bool unread = (int32_t)(consumer->last_group - consumer->tail) >= 0;
+
+        if (!(movement && consumer->last_mergeable && unread && merge_group(consumer))) {
+            consumer->last_group = consumer->group;
+            consumer->last_mergeable = movement;
+        }
+        consumer->group = consumer->head;
+        consumer->group_dropped = consumer->dropped;
+    }
+}
+
+/*
+Record the time from an interrupt to its events being read.
+*/
+static void record_latency(uint64_t timestamp, uint64_t now) {
+    uint64_t us = tsc_to_ns(now - timestamp);
+    div64_32(&us, NSEC_PER_USEC);
+
+    uint8_t bucket = 0;
+    while (us && bucket < INPUT_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    latency[bucket]++;
+}
+
+uint32_t input_read(input_consumer_t *consumer, input_event_t *events, uint32_t max) {
+    uint32_t n = consumer->head - consumer->tail;
+    if (n > max) {
+        n = max;
+    }
+
+    // Only read the TSC once per batch.
+    uint64_t now = n ? read_tsc() : 0;
+    for (uint32_t i = 0; i < n; i++) {
+        events[i] = consumer->buf[(consumer->tail + i) & (consumer->size - 1)];
+        if (events[i].type == INPUT_SYN) {
+            record_latency(events[i].timestamp, now);
+        }
+    }
+    consumer->tail += n;
+    return n;
+}
+
+const uint32_t *input_get_latency_histogram() {
+    return latency;
+}
+
+void input_print_stats() {
+    println("Input latency (interrupt to consumer):");
+    for (uint8_t i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        if (!latency[i]) {
+            continue;
+        }
+        if (i == INPUT_LATENCY_BUCKETS - 1) {
+            println("  >= %6u us: %u", 1u << (i - 1), latency[i]);
+        } else {
+            println("  <  %6u us: %u", 1u << i, latency[i]);
+        }
+    }
+}
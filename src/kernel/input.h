@@ -0,0 +1,134 @@
+#ifndef _DREWOS_INPUT_H_
+#define _DREWOS_INPUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Types of input event.
+typedef enum {
+    // Marks the end of a group of events which happened together, eg the
+    // movement and buttons of one mouse packet. value is 0.
+    INPUT_SYN,
+    // A key or button was pressed (value 1) or released (value 0).
+    INPUT_KEY,
+    // A key typed a character. value is the character.
+    INPUT_CHAR,
+    // Relative movement. value is the distance.
+    INPUT_REL
+} input_type_t;
+
+// Codes of INPUT_KEY events. Keyboard keys have codes 0-0xff: their make code
+// in scan code set 1 (see ps2_keyboard.h). Mouse buttons follow.
+#define INPUT_BTN_LEFT 0x100
+#define INPUT_BTN_RIGHT 0x101
+#define INPUT_BTN_MIDDLE 0x102
+#define INPUT_BTN_4 0x103
+#define INPUT_BTN_5 0x104
+
+// Codes of INPUT_REL events. Positive x is to the right, positive y is down
+// the screen, and positive wheel movement is towards the user.
+#define INPUT_REL_X 0
+#define INPUT_REL_Y 1
+#define INPUT_REL_WHEEL 2
+
+// Number of buckets in the latency histogram. Bucket n counts latencies of
+// less than 2^n microseconds (and at least 2^(n-1)); the last bucket counts
+// everything longer.
+#define INPUT_LATENCY_BUCKETS 16
+
+typedef struct {
+    // Value of the TSC when the interrupt which completed the event arrived.
+    uint64_t timestamp;
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} input_event_t;
+
+// A reader of input events. Every consumer receives every event, in its own
+// bounded queue. If a consumer falls behind, new events are dropped from its
+// queue. A group of movement events is merged into the previous group, if that
+// only holds movement on the same axes and hasn't been read yet, so a slow
+// consumer sees fewer, larger movements rather than running out of space. The
+// fields are private to input.c.
+typedef struct {
+    input_event_t *buf;
+
+    // Size of buf. Must be a power of 2.
+    uint32_t size;
+
+    uint32_t head;
+    uint32_t tail;
+
+    // Number of events dropped because the queue was full.
+    uint32_t dropped;
+
+    // Position of the first event of the group being reported, and the value
+    // of dropped when it started.
+    uint32_t group;
+    uint32_t group_dropped;
+
+    // Position of the first event of the previous group, and whether it only
+    // holds movement, so that the group being reported may be merged into it.
+    uint32_t last_group;
+    bool last_mergeable;
+} input_consumer_t;
+
+/*
+Initialise the input event layer. This must be called before any devices or
+consumers are registered.
+*/
+void input_init();
+
+/*
+Register a consumer, with an empty queue. Return false if too many consumers
+are already registered.
+
+@param consumer: The consumer. This must remain valid forever.
+@param buf: Storage for the consumer's queue.
+@param size: Number of events in buf. Must be a power of 2.
+*/
+bool input_register(input_consumer_t *consumer, input_event_t *buf, uint32_t size);
+
+/*
+Pass an event to every consumer. This must not be called from interrupt
+context: drivers report events as they decode them, from the idle loop.
+
+@param timestamp: Value of the TSC when the interrupt which completed the event
+arrived.
+@param type: The type of the event.
+@param code: The key, button or axis, depending on the type.
+@param value: The value, depending on the type.
+*/
+void input_report(uint64_t timestamp, input_type_t type, uint16_t code, int32_t value);
+
+/*
+Pass an INPUT_SYN event to every consumer, ending a group of events.
+
+@param timestamp: Value of the TSC when the interrupt which completed the group
+arrived.
+*/
+void input_sync(uint64_t timestamp);
+
+/*
+Remove up to max events from a consumer's queue, oldest first. Return the
+number of events removed. The time from each INPUT_SYN event's interrupt to
+now is recorded in the latency histogram.
+
+@param consumer: The consumer.
+@param events: Receives the events.
+@param max: The maximum number of events to remove.
+*/
+uint32_t input_read(input_consumer_t *consumer, input_event_t *events, uint32_t max);
+
+/*
+Get the latency histogram: the number of groups of events read by consumers,
+by the time from the interrupt to their being read.
+*/
+const uint32_t *input_get_latency_histogram();
+
+/*
+Print the latency histogram.
+*/
+void input_print_stats();
+
+#endif // _DREWOS_INPUT_H_
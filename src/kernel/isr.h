@@ -1,8 +0,0 @@
-#ifndef _DREWOS_ISR_H_
-#define _DREWOS_ISR_H_
-
-#include <stdint.h>
-
-void exception_handler(void);
-
-#endif // _DREWOS_ISR_H_
@@ -5,12 +5,70 @@
 #include "ps2.h"
 #include "acpi.h"
 #include "fadt.h"
+#include "cpuid.h"
+#include "memory.h"
+#include "fpu.h"
+#include "serial.h"
+#include "klog.h"
+#include "clock.h"
+#include "hpet.h"
+#include "pmtimer.h"
+#include "timer.h"
+#include "idle.h"
+#include "input.h"
+#include "pci.h"
+#include "sections.h"
+#include "multiboot.h"
+#include "memmap.h"
+
+static input_event_t echo_buf[64];
+static input_consumer_t echo_consumer;
+
+/*
+Echo the characters typed on the keyboard to the console. Called by the idle
+loop.
+*/
+static bool echo_keys() {
+    input_event_t batch[16];
+    uint32_t n;
+    while ((n = input_read(&echo_consumer, batch, 16))) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (batch[i].type == INPUT_CHAR) {
+                print("%c", (char)batch[i].value);
+            }
+        }
+    }
+    return false;
+}
+
+/*
+Entry point of the kernel, called by kernel_entry.
+
+@param boot_magic: MULTIBOOT_BOOTLOADER_MAGIC if the kernel was booted by a
+Multiboot loader, or DREWOS_BOOTLOADER_MAGIC if it was booted by our own.
+@param boot_info: The Multiboot information, passed by either loader.
+*/
+void main(uint32_t boot_magic, const multiboot_info_t *boot_info) {
+    // The loader's information isn't in reserved memory, so copy it first.
+    multiboot_init(boot_magic, boot_info);
+
+    klog_init();
+    input_init();
+    cpuid_init();
+    memory_init();
 
-void main() {
     clrscr();
     disable_cursor();
 
-    println("Kernel has been loaded successfully.");
+    println("Kernel has been loaded successfully, at %p-%p.", (void *)__kernel_start, (void *)__kernel_end);
+    if (multiboot_booted()) {
+        println("Booted by a Multiboot loader, with command line \"%s\".", multiboot_get_cmdline());
+    }
+
+    // Find out which memory is free. ACPI reserves its tables as it finds
+    // them.
+    memmap_init();
+    println("%llu KiB of memory available.", memmap_usable_bytes() >> 10);
     cprintln("Welcome to drewOS!", GREEN, BLACK);
     println("");
     const int NCOLOUR = 16;
@@ -25,11 +83,43 @@ void main() {
     idt_init();
     println("Interrupts successfully initialised.");
 
+    clock_init();
+    timers_init();
+
+    fpu_init();
+
+    // Now that SSE is enabled, faster memory routines may be available.
+    memory_init();
+    println("FPU successfully initialised.");
+
+    // Mirror all console output to COM1.
+    if (serial_init(SERIAL_MAX_BAUD)) {
+        console_add_sink(serial_write);
+        println("Serial console enabled on COM1.");
+    }
+
     // todo: disable usb legacy support
     // todo: init acpi
     acpi_init();
     println("ACPI successfully initialised.");
 
+    // Register the ACPI timers. These are better references for the TSC than
+    // the PIT.
+    hpet_init();
+    pmtimer_init();
+    clock_calibrate_tsc();
+
+    // The MADT tells us whether interrupts can be delivered by the APIC.
+    if (pic_switch_to_apic()) {
+        println("Interrupts are now delivered by the APIC.");
+    }
+
+    // PCI devices are found through the MCFG table, if there is one.
+    pci_init();
+
+    // Sleep between interrupts, preferably without the periodic tick.
+    idle_init();
+
     if (ps2_controller_exists()) {
         ps2_init();
     } else {
@@ -37,4 +127,12 @@ void main() {
     }
 
     println("\nThank you for using DrewOS!");
+
+    input_register(&echo_consumer, echo_buf, 64);
+    idle_add_poll(echo_keys);
+
+    // Interrupt handlers only append to the kernel log, and timer functions
+    // aren't called from interrupt context. The idle loop runs both, and
+    // sleeps when there's nothing to do.
+    idle_loop();
 }
@@ -0,0 +1,222 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "klog.h"
+#include "clock.h"
+#include "dmath.h"
+#include "format.h"
+#include "low_level.h"
+#include "vga.h"
+
+// Number of records in the log. Must be a power of 2.
+#define KLOG_SIZE 64
+#define KLOG_MASK (KLOG_SIZE - 1)
+
+#define MAX_LOG_SINKS 4
+
+// Size of the buffer used to format the prefix of each message on the console.
+#define PREFIX_BUFSIZE 32
+
+// A slot in the log.
+//
+// Slots are claimed by advancing head, and consumed by advancing tail. The
+// sequence number of each slot says which of these may happen next. For a
+// slot at position pos (ie slot pos & KLOG_MASK):
+//
+// - seq == pos: the slot is free, and a producer may claim it.
+// - seq == pos + 1: the slot holds a complete record, which the consumer may
+//   read.
+// - seq == pos + KLOG_SIZE: the record has been consumed, and the slot is free
+//   for the producer which claims position pos + KLOG_SIZE.
+//
+// A producer which is interrupted between claiming and filling a slot only
+// holds up the consumer, never another producer.
+typedef struct {
+    volatile uint32_t seq;
+    log_record_t record;
+} log_slot_t;
+
+static log_slot_t ring[KLOG_SIZE];
+
+// Next position to be claimed by a producer.
+static uint32_t head = 0;
+
+// Next position to be read by the consumer.
+static uint32_t tail = 0;
+
+static volatile log_level_t max_level = LOG_INFO;
+
+static uint32_t dropped = 0;
+
+// Number of dropped messages which have already been reported.
+static uint32_t reported = 0;
+
+// Set while klog_drain() is running, so that it's never reentered.
+static bool draining = false;
+
+static log_sink_t sinks[MAX_LOG_SINKS];
+static uint8_t nsinks = 0;
+
+static const char *level_names[] = { "err", "warn", "info", "debug" };
+static const colour_t level_colours[] = { LIGHT_RED, YELLOW, WHITE, GRAY };
+
+/*
+Write a record to the console, prefixed with its timestamp and level.
+*/
+static void console_sink(const log_record_t *record) {
+    // Show the timestamp as seconds and microseconds, like dmesg.
+    uint64_t secs = tsc_to_ns(record->timestamp);
+    div64_32(&secs, NSEC_PER_USEC);
+    uint32_t usecs = div64_32(&secs, 1000000);
+
+    char prefix[PREFIX_BUFSIZE];
+    uint32_t n = ksnprintf(prefix, PREFIX_BUFSIZE, "[%5llu.%06u] %s: ", secs, usecs, level_names[record->level]);
+    if (n >= PREFIX_BUFSIZE) {
+        n = PREFIX_BUFSIZE - 1;
+    }
+
+    console_write(prefix, n, DARK_GRAY, BLACK);
+    console_write(record->msg, record->len, level_colours[record->level], BLACK);
+    console_write("\n", 1, WHITE, BLACK);
+    console_flush();
+}
+
+void klog_init() {
+    for (uint32_t i = 0; i < KLOG_SIZE; i++) {
+        ring[i].seq = i;
+    }
+    head = tail = 0;
+    dropped = reported = 0;
+    draining = false;
+    nsinks = 0;
+
+    klog_add_sink(console_sink);
+}
+
+/*
+Claim the next free slot in the log. Return 0 if the log is full.
+
+@param pos: On success, receives the position of the claimed slot.
+*/
+static log_slot_t *claim(uint32_t *pos) {
+    uint32_t p = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+        log_slot_t *slot = &ring[p & KLOG_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - p);
+        if (diff == 0) {
+            // The slot is free. On failure, p is updated to the current head.
+            if (__atomic_compare_exchange_n(&head, &p, p + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return slot;
+            }
+        } else if (diff < 0) {
+            // The slot still holds a record from the previous lap, which has
+            // not been consumed.
+            return 0;
+        } else {
+            // Another producer claimed this position first.
+            p = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void klog(log_level_t level, const char *fmt, ...) {
+    if (level > max_level) {
+        return;
+    }
+
+    uint32_t pos;
+    log_slot_t *slot = claim(&pos);
+    if (!slot) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_record_t *record = &slot->record;
+    record->timestamp = read_tsc();
+    record->level = level;
+
+    va_list args;
+    va_start(args, fmt);
+    uint32_t len = kvsnprintf(record->msg, KLOG_MSG_SIZE, fmt, args);
+    va_end(args);
+    record->len = len < KLOG_MSG_SIZE ? len : KLOG_MSG_SIZE - 1;
+
+    // Publish the record to the consumer.
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void klog_set_level(log_level_t level) {
+    max_level = level;
+}
+
+bool klog_add_sink(log_sink_t sink) {
+    if (nsinks >= MAX_LOG_SINKS) {
+        return false;
+    }
+    sinks[nsinks++] = sink;
+    return true;
+}
+
+static void emit(const log_record_t *record) {
+    for (uint8_t i = 0; i < nsinks; i++) {
+        sinks[i](record);
+    }
+}
+
+/*
+If any messages have been dropped since the last report, pass a warning to the
+sinks saying how many.
+*/
+static void report_dropped() {
+    uint32_t n = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (n == reported) {
+        return;
+    }
+
+    log_record_t record;
+    record.timestamp = read_tsc();
+    record.level = LOG_WARN;
+    uint32_t len = ksnprintf(record.msg, KLOG_MSG_SIZE, "klog: %u messages dropped", n - reported);
+    record.len = len < KLOG_MSG_SIZE ? len : KLOG_MSG_SIZE - 1;
+    reported = n;
+
+    emit(&record);
+}
+
+void klog_drain() {
+    if (__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (;;) {
+        log_slot_t *slot = &ring[tail & KLOG_MASK];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        // Stop at the first slot which hasn't been published yet. It may
+        // have been claimed by a producer which is still filling it in.
+        if (seq != tail + 1) {
+            break;
+        }
+
+        emit(&slot->record);
+
+        // Hand the slot back to the producers.
+        __atomic_store_n(&slot->seq, tail + KLOG_SIZE, __ATOMIC_RELEASE);
+        tail++;
+    }
+
+    report_dropped();
+
+    __atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+}
+
+bool klog_pending() {
+    uint32_t seq = __atomic_load_n(&ring[tail & KLOG_MASK].seq, __ATOMIC_ACQUIRE);
+    return seq == tail + 1 || __atomic_load_n(&dropped, __ATOMIC_RELAXED) != reported;
+}
+
+uint32_t klog_get_dropped() {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,85 @@
+#ifndef _DREWOS_KLOG_H_
+#define _DREWOS_KLOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum length of a log message, including the NULL terminator. Longer
+// messages are truncated.
+#define KLOG_MSG_SIZE 112
+
+// Severity of a log message. Lower values are more severe.
+typedef enum {
+    LOG_ERR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG
+} log_level_t;
+
+// A single message in the kernel log.
+typedef struct {
+    // Value of the time-stamp counter when the message was logged. Use
+    // tsc_to_ns() to convert this to a time.
+    uint64_t timestamp;
+    uint8_t level;
+    // Length of the message, excluding the NULL terminator.
+    uint8_t len;
+    char msg[KLOG_MSG_SIZE];
+} log_record_t;
+
+// A function which receives every message drained from the kernel log.
+typedef void (*log_sink_t)(const log_record_t *record);
+
+/*
+Initialise the kernel log, and register the console as a sink. This must be
+called before anything is logged.
+*/
+void klog_init();
+
+/*
+Append a message to the kernel log. This never blocks and never writes to a
+device, so it may be called from any context, including interrupt handlers. The
+message is written out later, by klog_drain().
+
+Messages less severe than the current level are discarded before they are
+formatted. If the log is full, the message is discarded and counted as dropped.
+
+@param level: Severity of the message.
+@param fmt: The message format string. See kvsnprintf() for details.
+@param ...: Arguments referenced by the format string.
+*/
+void klog(log_level_t level, const char *fmt, ...);
+
+/*
+Set the least severe level of message which will be logged. The default is
+LOG_INFO.
+
+@param level: The level.
+*/
+void klog_set_level(log_level_t level);
+
+/*
+Register a sink which will receive every message subsequently drained from the
+log. Return false if too many sinks are already registered.
+
+@param sink: The sink.
+*/
+bool klog_add_sink(log_sink_t sink);
+
+/*
+Pass every message in the log to each registered sink, and remove them from the
+log. This must not be called from interrupt context.
+*/
+void klog_drain();
+
+/*
+Check whether there are messages waiting to be drained.
+*/
+bool klog_pending();
+
+/*
+Get the number of messages discarded because the log was full.
+*/
+uint32_t klog_get_dropped();
+
+#endif // _DREWOS_KLOG_H_
@@ -25,6 +25,69 @@ void write_word(unsigned short port, unsigned short data) {
     __asm__("out %%ax, %%dx" : : "a" (data), "d" (port));
 }
 
+uint32_t read_dword(unsigned short port) {
+    uint32_t result;
+    __asm__ volatile("in %%dx, %%eax" : "=a" (result) : "d" (port));
+    return result;
+}
+
+void write_dword(unsigned short port, uint32_t data) {
+    __asm__ volatile("out %%eax, %%dx" : : "a" (data), "d" (port));
+}
+
 inline void io_wait() {
     write_byte(0x80, 0);
 }
+
+uint64_t read_tsc() {
+    // RDTSC returns the low 32 bits in EAX and the high 32 bits in EDX. The
+    // "=A" constraint combines the two into a 64-bit result on i386.
+    uint64_t tsc;
+    __asm__ volatile("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+uint32_t read_cr0() {
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+void write_cr0(uint32_t cr0) {
+    __asm__ volatile("mov %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+uint32_t read_cr4() {
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+void write_cr4(uint32_t cr4) {
+    __asm__ volatile("mov %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+uint64_t read_msr(uint32_t msr) {
+    uint64_t value;
+    __asm__ volatile("rdmsr" : "=A" (value) : "c" (msr));
+    return value;
+}
+
+void write_msr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c" (msr), "A" (value) : "memory");
+}
+
+uint32_t irq_save() {
+    uint32_t flags;
+    __asm__ volatile("pushfl\n\t"
+                     "popl %0\n\t"
+                     "cli"
+                     : "=r" (flags) : : "memory");
+    return flags;
+}
+
+void irq_restore(uint32_t flags) {
+    __asm__ volatile("pushl %0\n\t"
+                     "popfl"
+                     : : "r" (flags) : "memory", "cc");
+}
@@ -1,6 +1,8 @@
 #ifndef _DREWOS_LOW_LEVEL_H_
 #define _DREWOS_LOW_LEVEL_H_
 
+#include <stdint.h>
+
 /*
 Read a single byte from the specified port.
 
@@ -31,6 +33,21 @@ Write a word to the specified port.
 */
 void write_word(unsigned short port, unsigned short data);
 
+/*
+Read a double word from the specified port.
+
+@param port: The port from which to read.
+*/
+uint32_t read_dword(unsigned short port);
+
+/*
+Write a double word to the specified port.
+
+@param port: The port to which data will be written.
+@param data: The double word to be written.
+*/
+void write_dword(unsigned short port, uint32_t data);
+
 /*
 Wait a very small amount of time (usually 1-4ms). Useful for implementing a
 small delay for PIC remapping on old hardware, or generally as a simple but
@@ -38,4 +55,58 @@ imprecise wait.
 */
 void io_wait();
 
+/*
+Read the CPU's time-stamp counter. This counts clock cycles since reset, and is
+useful for measuring the cost of short code paths.
+*/
+uint64_t read_tsc();
+
+/*
+Read control register 0.
+*/
+uint32_t read_cr0();
+
+/*
+Write control register 0.
+*/
+void write_cr0(uint32_t cr0);
+
+/*
+Read control register 4.
+*/
+uint32_t read_cr4();
+
+/*
+Write control register 4.
+*/
+void write_cr4(uint32_t cr4);
+
+/*
+Read a model-specific register.
+
+@param msr: The register number.
+*/
+uint64_t read_msr(uint32_t msr);
+
+/*
+Write a model-specific register.
+
+@param msr: The register number.
+@param value: The value to be written.
+*/
+void write_msr(uint32_t msr, uint64_t value);
+
+/*
+Disable interrupts, and return the previous value of EFLAGS so that the
+interrupt flag can later be restored with irq_restore().
+*/
+uint32_t irq_save();
+
+/*
+Restore the interrupt flag to the state saved by irq_save().
+
+@param flags: The value returned by irq_save().
+*/
+void irq_restore(uint32_t flags);
+
 #endif // _DREWOS_LOW_LEVEL_H_
@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memmap.h"
+#include "multiboot.h"
+#include "sections.h"
+#include "vga.h"
+
+// The real mode IVT and BIOS data area, which the ACPI code reads.
+#define BIOS_DATA_END 0x1000
+
+// The VGA memory window, which the console is written to.
+#define VGA_WINDOW_START 0xa0000
+#define VGA_WINDOW_END 0xc0000
+
+// Conventional memory which is assumed to be usable if the loader passes no
+// memory map. The EBDA may be anywhere above this.
+#define FALLBACK_MEMORY_END 0x80000
+
+static memmap_range_t usable[MEMMAP_MAX_USABLE];
+static uint32_t usable_count = 0;
+
+static memmap_range_t reserved[MEMMAP_MAX_RESERVED];
+static uint32_t reserved_count = 0;
+
+static inline uint64_t page_round_down(uint64_t x) {
+    return x & ~(uint64_t)(MEMMAP_PAGE_SIZE - 1);
+}
+
+static inline uint64_t page_round_up(uint64_t x) {
+    return page_round_down(x + MEMMAP_PAGE_SIZE - 1);
+}
+
+static inline uint64_t range_end(const memmap_range_t *range) {
+    return range->base + range->length;
+}
+
+/*
+Insert a range at index i of an array of n ranges, which has room for it.
+*/
+static void insert_range(memmap_range_t *ranges, uint32_t n, uint32_t i, memmap_range_t range) {
+    for (uint32_t j = n; j > i; j--) {
+        ranges[j] = ranges[j - 1];
+    }
+    ranges[i] = range;
+}
+
+/*
+Remove the range at index i of an array of n ranges.
+*/
+static void remove_range(memmap_range_t *ranges, uint32_t n, uint32_t i) {
+    for (uint32_t j = i; j + 1 < n; j++) {
+        ranges[j] = ranges[j + 1];
+    }
+}
+
+/*
+Add a usable range reported by the loader, shrunk to whole pages. The usable
+ranges are sorted and merged afterwards, by merge_usable().
+*/
+static void add_usable(uint64_t base, uint64_t length) {
+    uint64_t start = page_round_up(base);
+    uint64_t end = page_round_down(base + length);
+    if (end <= start) {
+        return;
+    }
+    if (usable_count == MEMMAP_MAX_USABLE) {
+        println("memmap: too many usable ranges; ignoring %llx-%llx", start, end);
+        return;
+    }
+    usable[usable_count++] = (memmap_range_t){ start, end - start, MEMMAP_USABLE };
+}
+
+/*
+Sort the usable ranges by address, and merge any which overlap or touch. There
+are few enough of them for an insertion sort.
+*/
+static void merge_usable() {
+    for (uint32_t i = 1; i < usable_count; i++) {
+        memmap_range_t range = usable[i];
+        uint32_t j = i;
+        while (j > 0 && usable[j - 1].base > range.base) {
+            usable[j] = usable[j - 1];
+            j--;
+        }
+        usable[j] = range;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < usable_count; i++) {
+        if (n > 0 && usable[i].base <= range_end(&usable[n - 1])) {
+            uint64_t end = range_end(&usable[i]);
+            if (end > range_end(&usable[n - 1])) {
+                usable[n - 1].length = end - usable[n - 1].base;
+            }
+        } else {
+            usable[n++] = usable[i];
+        }
+    }
+    usable_count = n;
+}
+
+/*
+Record a reserved range, keeping the reserved ranges sorted, and merging it
+with any ranges of the same type which it overlaps or touches.
+*/
+static void record_reserved(uint64_t start, uint64_t end, memmap_type_t type) {
+    uint32_t i = 0;
+    while (i < reserved_count && reserved[i].base <= start) {
+        i++;
+    }
+
+    // Extend the previous range, if it's of the same type and reaches this
+    // one. Otherwise insert a new range.
+    if (i > 0 && reserved[i - 1].type == type && range_end(&reserved[i - 1]) >= start) {
+        i--;
+        if (end > range_end(&reserved[i])) {
+            reserved[i].length = end - reserved[i].base;
+        }
+    } else if (reserved_count < MEMMAP_MAX_RESERVED) {
+        insert_range(reserved, reserved_count++, i, (memmap_range_t){ start, end - start, type });
+    } else {
+        println("memmap: too many reserved ranges; not recording %llx-%llx", start, end);
+        return;
+    }
+
+    // Absorb any following ranges of the same type which the range now
+    // reaches.
+    while (i + 1 < reserved_count && reserved[i + 1].type == type
+            && reserved[i + 1].base <= range_end(&reserved[i])) {
+        uint64_t next_end = range_end(&reserved[i + 1]);
+        if (next_end > range_end(&reserved[i])) {
+            reserved[i].length = next_end - reserved[i].base;
+        }
+        remove_range(reserved, reserved_count--, i + 1);
+    }
+}
+
+void memmap_init() {
+    usable_count = 0;
+    reserved_count = 0;
+
+    const multiboot_mmap_entry_t *entries;
+    uint32_t n = multiboot_get_mmap(&entries);
+    for (uint32_t i = 0; i < n; i++) {
+        if (entries[i].type == MULTIBOOT_MEMORY_AVAILABLE) {
+            add_usable(entries[i].addr, entries[i].len);
+        }
+    }
+    if (!usable_count) {
+        println("memmap: no memory map; assuming %u KiB of memory", FALLBACK_MEMORY_END >> 10);
+        add_usable(0, FALLBACK_MEMORY_END);
+    }
+    merge_usable();
+
+    // The map may have usable ranges which overlap reserved ones, in which
+    // case the memory is reserved.
+    for (uint32_t i = 0; i < n; i++) {
+        if (entries[i].type != MULTIBOOT_MEMORY_AVAILABLE) {
+            memmap_reserve(entries[i].addr, entries[i].len, MEMMAP_FIRMWARE);
+        }
+    }
+
+    memmap_reserve(0, BIOS_DATA_END, MEMMAP_FIRMWARE);
+    memmap_reserve(VGA_WINDOW_START, VGA_WINDOW_END - VGA_WINDOW_START, MEMMAP_VGA);
+    memmap_reserve((uintptr_t)__kernel_start, __kernel_end - __kernel_start, MEMMAP_KERNEL);
+}
+
+void memmap_reserve(uint64_t base, uint64_t length, memmap_type_t type) {
+    if (!length) {
+        return;
+    }
+    uint64_t start = page_round_down(base);
+    uint64_t end = page_round_up(base + length);
+    record_reserved(start, end, type);
+
+    // Remove the range from the usable ranges it overlaps, splitting any
+    // which contain it.
+    for (uint32_t i = 0; i < usable_count; i++) {
+        memmap_range_t *range = &usable[i];
+        uint64_t r_end = range_end(range);
+        if (end <= range->base || start >= r_end) {
+            continue;
+        }
+
+        if (start <= range->base && end >= r_end) {
+            remove_range(usable, usable_count--, i--);
+        } else if (start <= range->base) {
+            range->base = end;
+            range->length = r_end - end;
+        } else if (end >= r_end) {
+            range->length = start - range->base;
+        } else {
+            memmap_range_t upper = { end, r_end - end, range->type };
+            range->length = start - range->base;
+            if (usable_count < MEMMAP_MAX_USABLE) {
+                insert_range(usable, usable_count++, ++i, upper);
+            } else if (upper.length > range->length) {
+                *range = upper;
+            }
+        }
+    }
+}
+
+uint32_t memmap_get_usable(const memmap_range_t **ranges) {
+    *ranges = usable;
+    return usable_count;
+}
+
+uint32_t memmap_get_reserved(const memmap_range_t **ranges) {
+    *ranges = reserved;
+    return reserved_count;
+}
+
+uint64_t memmap_usable_bytes() {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < usable_count; i++) {
+        total += usable[i].length;
+    }
+    return total;
+}
+
+static const char *type_name(memmap_type_t type) {
+    switch (type) {
+        case MEMMAP_USABLE:
+            return "usable";
+        case MEMMAP_KERNEL:
+            return "kernel";
+        case MEMMAP_ACPI:
+            return "acpi";
+        case MEMMAP_VGA:
+            return "vga";
+        default:
+            return "firmware";
+    }
+}
+
+void memmap_print() {
+    for (uint32_t i = 0; i < usable_count; i++) {
+        println("%016llx-%016llx %s", usable[i].base, range_end(&usable[i]) - 1,
+                type_name(usable[i].type));
+    }
+    for (uint32_t i = 0; i < reserved_count; i++) {
+        println("%016llx-%016llx %s", reserved[i].base, range_end(&reserved[i]) - 1,
+                type_name(reserved[i].type));
+    }
+}
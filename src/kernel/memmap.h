@@ -0,0 +1,78 @@
+#ifndef _DREWOS_MEMMAP_H_
+#define _DREWOS_MEMMAP_H_
+
+#include <stdint.h>
+
+// Maximum number of usable and reserved ranges recorded. If a reservation
+// splits a usable range when there's no room for another, the smaller part is
+// dropped.
+#define MEMMAP_MAX_USABLE 64
+#define MEMMAP_MAX_RESERVED 64
+
+// Usable ranges are aligned to this, and reservations are rounded out to it.
+#define MEMMAP_PAGE_SIZE 0x1000
+
+// What a range of physical memory is used by.
+typedef enum {
+    MEMMAP_USABLE,
+
+    // Reserved by the firmware, or not RAM at all.
+    MEMMAP_FIRMWARE,
+    MEMMAP_KERNEL,
+    MEMMAP_ACPI,
+    MEMMAP_VGA
+} memmap_type_t;
+
+// A range of physical memory, from base up to but excluding base + length.
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    memmap_type_t type;
+} memmap_range_t;
+
+/*
+Build the physical memory map from the memory map passed by the loader (see
+multiboot_get_mmap()). The usable ranges are sorted and merged, and the kernel,
+the VGA window and the real mode IVT and BIOS data area are reserved. This must
+be called after multiboot_init(), and before anything reserves memory.
+*/
+void memmap_init();
+
+/*
+Reserve a range of physical memory, so that it's no longer usable. The range
+is rounded out to whole pages. Reserving memory which isn't usable is allowed,
+and the range is still recorded as reserved.
+
+@param base: Physical address of the start of the range.
+@param length: Length of the range in bytes.
+@param type: What the range is used by.
+*/
+void memmap_reserve(uint64_t base, uint64_t length, memmap_type_t type);
+
+/*
+Get the usable ranges of physical memory, in order of address. They don't
+overlap or touch, and are page aligned. Return the number of ranges.
+
+@param ranges: Receives a pointer to the ranges.
+*/
+uint32_t memmap_get_usable(const memmap_range_t **ranges);
+
+/*
+Get the reserved ranges of physical memory, in order of address. Ranges of the
+same type which overlap or touch are merged. Return the number of ranges.
+
+@param ranges: Receives a pointer to the ranges.
+*/
+uint32_t memmap_get_reserved(const memmap_range_t **ranges);
+
+/*
+Get the total size in bytes of the usable ranges.
+*/
+uint64_t memmap_usable_bytes();
+
+/*
+Print the usable and reserved ranges.
+*/
+void memmap_print();
+
+#endif // _DREWOS_MEMMAP_H_
@@ -0,0 +1,333 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+#include "cpuid.h"
+#include "clock.h"
+#include "dmath.h"
+#include "low_level.h"
+#include "fpu.h"
+#include "vga.h"
+
+// CR4 bit which is set when the OS supports fxsave/fxrstor, and therefore SSE.
+#define CR4_OSFXSR (1 << 9)
+
+// Copies and fills shorter than this are not worth the setup cost of the SSE2
+// loops, and fall back to rep movsd/stosd.
+#define SSE_THRESHOLD 256
+
+// Number of bytes moved by each iteration of the SSE2 loops.
+#define SSE_BLOCK 64
+
+// Scratch buffers used by memory_benchmark(). Nothing else uses this memory
+// yet. Bit 20 is clear throughout both buffers, so they are usable even if the
+// A20 line is disabled.
+#define BENCH_SRC 0x200000
+#define BENCH_DST 0x400000
+#define BENCH_MAX_SIZE (1024 * 1024)
+
+// Each benchmark moves this many bytes in total, regardless of buffer size.
+#define BENCH_TOTAL (4 * 1024 * 1024)
+
+typedef void *(*memcpy_fn)(void *dst, const void *src, size_t n);
+typedef void *(*memset_fn)(void *dst, int c, size_t n);
+
+// An implementation of memcpy() and memset().
+typedef struct {
+    const char *name;
+    memcpy_fn copy;
+    memset_fn set;
+    bool (*supported)();
+} memory_impl_t;
+
+static void *memcpy_movsd(void *dst, const void *src, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile("rep movsl\n\t"
+                     "movl %4, %%ecx\n\t"
+                     "andl $3, %%ecx\n\t"
+                     "rep movsb"
+                     : "=&c" (d0), "=&D" (d1), "=&S" (d2)
+                     : "0" (n / 4), "g" (n), "1" (dst), "2" (src)
+                     : "memory");
+    return dst;
+}
+
+static void *memset_stosd(void *dst, int c, size_t n) {
+    uint32_t value = (uint8_t)c * 0x01010101u;
+    uint32_t d0, d1;
+    __asm__ volatile("rep stosl\n\t"
+                     "movl %3, %%ecx\n\t"
+                     "andl $3, %%ecx\n\t"
+                     "rep stosb"
+                     : "=&c" (d0), "=&D" (d1)
+                     : "a" (value), "g" (n), "0" (n / 4), "1" (dst)
+                     : "memory");
+    return dst;
+}
+
+/*
+With enhanced rep movsb/stosb (ERMS), the microcode moves whole cache lines
+where it can, so a plain byte-granular rep movsb is as fast as anything else.
+*/
+static void *memcpy_erms(void *dst, const void *src, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile("rep movsb"
+                     : "=c" (d0), "=D" (d1), "=S" (d2)
+                     : "0" (n), "1" (dst), "2" (src)
+                     : "memory");
+    return dst;
+}
+
+static void *memset_erms(void *dst, int c, size_t n) {
+    uint32_t d0, d1;
+    __asm__ volatile("rep stosb"
+                     : "=c" (d0), "=D" (d1)
+                     : "a" (c), "0" (n), "1" (dst)
+                     : "memory");
+    return dst;
+}
+
+// The SSE2 implementations don't declare the XMM registers as clobbered. The
+// kernel is compiled without SSE support, so the compiler never keeps values
+// in them, and the state of the FPU context which owns them is saved by
+// kernel_fpu_begin() before they're touched. Interrupts are disabled while the
+// XMM registers are in use, as interrupt handlers may also call memcpy() or
+// memset() and XMM registers are not saved on interrupt entry. If the
+// registers can't be claimed, the rep movsd/stosd loops are used instead.
+
+static void *memcpy_sse2(void *dst, const void *src, size_t n) {
+    if (n < SSE_THRESHOLD) {
+        return memcpy_movsd(dst, src, n);
+    }
+
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    // Copy enough bytes to align the destination to 16 bytes, so that the main
+    // loop can use aligned stores.
+    size_t head = -(uintptr_t)d & 15;
+    memcpy_movsd(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    uint32_t flags = irq_save();
+    if (!kernel_fpu_begin()) {
+        irq_restore(flags);
+        memcpy_movsd(d, s, n);
+        return dst;
+    }
+
+    for (size_t i = n / SSE_BLOCK; i; i--, d += SSE_BLOCK, s += SSE_BLOCK) {
+        __asm__ volatile("movdqu 0(%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movdqa %%xmm0, 0(%0)\n\t"
+                         "movdqa %%xmm1, 16(%0)\n\t"
+                         "movdqa %%xmm2, 32(%0)\n\t"
+                         "movdqa %%xmm3, 48(%0)"
+                         : : "r" (d), "r" (s) : "memory");
+    }
+    kernel_fpu_end();
+    irq_restore(flags);
+
+    memcpy_movsd(d, s, n % SSE_BLOCK);
+    return dst;
+}
+
+static void *memset_sse2(void *dst, int c, size_t n) {
+    if (n < SSE_THRESHOLD) {
+        return memset_stosd(dst, c, n);
+    }
+
+    uint8_t *d = dst;
+    size_t head = -(uintptr_t)d & 15;
+    memset_stosd(d, c, head);
+    d += head;
+    n -= head;
+
+    uint32_t value = (uint8_t)c * 0x01010101u;
+    uint32_t flags = irq_save();
+    if (!kernel_fpu_begin()) {
+        irq_restore(flags);
+        memset_stosd(d, c, n);
+        return dst;
+    }
+
+    // Broadcast the 32-bit pattern to all four lanes of xmm0.
+    __asm__ volatile("movd %0, %%xmm0\n\t"
+                     "pshufd $0, %%xmm0, %%xmm0"
+                     : : "r" (value));
+
+    for (size_t i = n / SSE_BLOCK; i; i--, d += SSE_BLOCK) {
+        __asm__ volatile("movdqa %%xmm0, 0(%0)\n\t"
+                         "movdqa %%xmm0, 16(%0)\n\t"
+                         "movdqa %%xmm0, 32(%0)\n\t"
+                         "movdqa %%xmm0, 48(%0)"
+                         : : "r" (d) : "memory");
+    }
+    kernel_fpu_end();
+    irq_restore(flags);
+
+    memset_stosd(d, c, n % SSE_BLOCK);
+    return dst;
+}
+
+static bool movsd_supported() {
+    return true;
+}
+
+static bool erms_supported() {
+    return cpu_has_feature(CPU_FEATURE_ERMS);
+}
+
+static bool sse2_supported() {
+    return cpu_has_feature(CPU_FEATURE_SSE2) && (read_cr4() & CR4_OSFXSR);
+}
+
+// All implementations, in increasing order of preference.
+static const memory_impl_t impls[] = {
+    { "movsd", memcpy_movsd, memset_stosd, movsd_supported },
+    { "sse2", memcpy_sse2, memset_sse2, sse2_supported },
+    { "erms", memcpy_erms, memset_erms, erms_supported }
+};
+
+#define NIMPL (sizeof(impls) / sizeof(impls[0]))
+
+static const memory_impl_t *impl = &impls[0];
+
+void memory_init() {
+    for (uint8_t i = 0; i < NIMPL; i++) {
+        if (impls[i].supported()) {
+            impl = &impls[i];
+        }
+    }
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    return impl->copy(dst, src, n);
+}
+
+void *memset(void *dst, int c, size_t n) {
+    return impl->set(dst, c, n);
+}
+
+/*
+Copy n bytes from src to dst, starting at the end. This is only needed when dst
+overlaps the end of src, so it doesn't need to be fast.
+*/
+static void *memcpy_backwards(void *dst, const void *src, size_t n) {
+    uint32_t d0, d1, d2;
+
+    // Copy the last n % 4 bytes one at a time, then the rest 4 bytes at a time.
+    // Between the two, esi and edi must be moved back from the last byte
+    // copied to the start of the next dword.
+    __asm__ volatile("std\n\t"
+                     "rep movsb\n\t"
+                     "subl $3, %%esi\n\t"
+                     "subl $3, %%edi\n\t"
+                     "movl %4, %%ecx\n\t"
+                     "rep movsl\n\t"
+                     "cld"
+                     : "=&c" (d0), "=&D" (d1), "=&S" (d2)
+                     : "0" (n % 4), "g" (n / 4), "1" ((uint8_t *)dst + n - 1), "2" ((const uint8_t *)src + n - 1)
+                     : "memory");
+    return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    // Copying forwards is safe unless dst lies inside the source region.
+    if ((uintptr_t)dst - (uintptr_t)src >= n) {
+        return memcpy(dst, src, n);
+    }
+    return memcpy_backwards(dst, src, n);
+}
+
+void *memset16(void *dst, uint16_t value, size_t n) {
+    uint32_t d0, d1;
+    __asm__ volatile("rep stosw"
+                     : "=c" (d0), "=D" (d1)
+                     : "a" (value), "0" (n), "1" (dst)
+                     : "memory");
+    return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *x = a;
+    const uint8_t *y = b;
+
+    // Skip over equal dwords, then find the first byte which differs.
+    while (n >= 4 && *(const uint32_t *)x == *(const uint32_t *)y) {
+        x += 4;
+        y += 4;
+        n -= 4;
+    }
+
+    for (; n; n--, x++, y++) {
+        if (*x != *y) {
+            return *x - *y;
+        }
+    }
+    return 0;
+}
+
+/*
+Return the throughput of copy (if non-null) or set, in MB/s, over enough calls
+to move BENCH_TOTAL bytes.
+*/
+static uint32_t bench(memcpy_fn copy, memset_fn set, size_t size) {
+    void *src = (void *)BENCH_SRC;
+    void *dst = (void *)BENCH_DST;
+    uint32_t ncall = BENCH_TOTAL / size;
+
+    uint64_t start = ktime_ns();
+    for (uint32_t i = 0; i < ncall; i++) {
+        if (copy) {
+            copy(dst, src, size);
+        } else {
+            set(dst, 0, size);
+        }
+    }
+    uint64_t ns = ktime_ns() - start;
+
+    // Clamp the elapsed time so that it can be used as a 32-bit divisor.
+    uint32_t elapsed = ns >> 32 ? UINT32_MAX : (uint32_t)ns;
+    if (!elapsed) {
+        elapsed = 1;
+    }
+
+    // bytes/ns = GB/s, so scale up by 1000 to get MB/s.
+    uint64_t throughput = (uint64_t)ncall * size * 1000;
+    div64_32(&throughput, elapsed);
+    return (uint32_t)throughput;
+}
+
+void memory_benchmark() {
+    // Make sure the source buffer has been touched before it's timed.
+    memset((void *)BENCH_SRC, 0xaa, BENCH_MAX_SIZE);
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        println("%s (MB/s):", pass ? "memset" : "memcpy");
+
+        print("%8s", "size");
+        for (uint8_t i = 0; i < NIMPL; i++) {
+            if (impls[i].supported()) {
+                print("%10s", impls[i].name);
+            }
+        }
+        println("");
+
+        for (size_t size = 16; size <= BENCH_MAX_SIZE; size *= 4) {
+            print("%8u", size);
+            for (uint8_t i = 0; i < NIMPL; i++) {
+                if (impls[i].supported()) {
+                    memcpy_fn copy = pass ? 0 : impls[i].copy;
+                    print("%10u", bench(copy, impls[i].set, size));
+                }
+            }
+            println("");
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _DREWOS_MEMORY_H_
+#define _DREWOS_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Copy n bytes from src to dst. The regions must not overlap.
+
+@param dst: Pointer to destination.
+@param src: Pointer to source.
+@param n: Number of bytes to be copied.
+
+@return dst.
+*/
+void *memcpy(void *dst, const void *src, size_t n);
+
+/*
+Copy n bytes from src to dst. The regions may overlap.
+
+@param dst: Pointer to destination.
+@param src: Pointer to source.
+@param n: Number of bytes to be copied.
+
+@return dst.
+*/
+void *memmove(void *dst, const void *src, size_t n);
+
+/*
+Fill n bytes of memory with a byte value.
+
+@param dst: Pointer to destination.
+@param c: The value (converted to unsigned char).
+@param n: Number of bytes to be filled.
+
+@return dst.
+*/
+void *memset(void *dst, int c, size_t n);
+
+/*
+Fill n 16-bit words of memory with a 16-bit value. Useful for filling VGA text
+cells.
+
+@param dst: Pointer to destination.
+@param value: The value.
+@param n: Number of words to be filled.
+
+@return dst.
+*/
+void *memset16(void *dst, uint16_t value, size_t n);
+
+/*
+Compare n bytes of memory. Return zero if they're equal, or the difference
+between the first pair of bytes which differ (as unsigned char).
+*/
+int memcmp(const void *a, const void *b, size_t n);
+
+/*
+Select the fastest implementation of memcpy() and memset() supported by the
+CPU. This must be called after cpuid_init(), and again whenever SSE is enabled.
+Until then, rep movsd/stosd implementations are used.
+*/
+void memory_init();
+
+/*
+Time every supported implementation of memcpy() and memset() on buffers from
+16 B to 1 MiB, and print the throughput of each.
+
+Note that this uses the memory between 2 MiB and 5 MiB as scratch space.
+*/
+void memory_benchmark();
+
+#endif // _DREWOS_MEMORY_H_
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "multiboot.h"
+
+static bool booted = false;
+
+static char cmdline[MULTIBOOT_CMDLINE_LEN];
+
+static multiboot_mmap_entry_t mmap[MULTIBOOT_MAX_MMAP];
+static uint32_t mmap_count = 0;
+
+/*
+Copy the memory map. Entries are variable sized, and are walked by their size
+field.
+*/
+static void copy_mmap(const multiboot_info_t *info) {
+    uintptr_t addr = info->mmap_addr;
+    uintptr_t end = addr + info->mmap_length;
+    while (addr < end && mmap_count < MULTIBOOT_MAX_MMAP) {
+        const multiboot_mmap_entry_t *entry = (const multiboot_mmap_entry_t *)addr;
+        multiboot_mmap_entry_t *copy = &mmap[mmap_count++];
+        copy->size = sizeof(multiboot_mmap_entry_t) - sizeof(entry->size);
+        copy->addr = entry->addr;
+        copy->len = entry->len;
+        copy->type = entry->type;
+        addr += entry->size + sizeof(entry->size);
+    }
+}
+
+void multiboot_init(uint32_t magic, const multiboot_info_t *info) {
+    booted = magic == MULTIBOOT_BOOTLOADER_MAGIC;
+    cmdline[0] = '\0';
+    mmap_count = 0;
+    if (!booted && magic != DREWOS_BOOTLOADER_MAGIC) {
+        return;
+    }
+
+    if (info->flags & MULTIBOOT_INFO_CMDLINE) {
+        const char *s = (const char *)info->cmdline;
+        uint32_t i = 0;
+        while (s[i] && i < MULTIBOOT_CMDLINE_LEN - 1) {
+            cmdline[i] = s[i];
+            i++;
+        }
+        cmdline[i] = '\0';
+    }
+
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        copy_mmap(info);
+    }
+}
+
+bool multiboot_booted() {
+    return booted;
+}
+
+const char *multiboot_get_cmdline() {
+    return cmdline;
+}
+
+const char *multiboot_get_option(const char *name) {
+    const char *s = cmdline;
+    while (*s) {
+        // Compare the name with the start of this option.
+        uint32_t i = 0;
+        while (name[i] && s[i] == name[i]) {
+            i++;
+        }
+        if (!name[i]) {
+            if (s[i] == '=') {
+                return s + i + 1;
+            }
+            if (s[i] == ' ' || s[i] == '\0') {
+                return "";
+            }
+        }
+
+        // Skip to the next option.
+        while (*s && *s != ' ') {
+            s++;
+        }
+        while (*s == ' ') {
+            s++;
+        }
+    }
+    return 0;
+}
+
+uint32_t multiboot_get_mmap(const multiboot_mmap_entry_t **entries) {
+    *entries = mmap;
+    return mmap_count;
+}
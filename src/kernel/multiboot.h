@@ -0,0 +1,103 @@
+#ifndef _DREWOS_MULTIBOOT_H_
+#define _DREWOS_MULTIBOOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Passed in eax by a Multiboot loader.
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2badb002
+
+// Passed in eax by our own bootloader. It passes a multiboot_info_t in ebx too,
+// but with only the memory map, which it gets from the BIOS.
+#define DREWOS_BOOTLOADER_MAGIC 0x44524557
+
+// Bits of multiboot_info_t.flags, marking which fields are valid.
+#define MULTIBOOT_INFO_MEMORY (1 << 0)
+#define MULTIBOOT_INFO_CMDLINE (1 << 2)
+#define MULTIBOOT_INFO_MEM_MAP (1 << 6)
+#define MULTIBOOT_INFO_LOADER_NAME (1 << 9)
+
+// Type of usable RAM in the memory map. Anything else is reserved.
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+// Maximum number of memory map entries recorded. Any more are ignored.
+#define MULTIBOOT_MAX_MMAP 32
+
+// Maximum length of the command line recorded, including the terminator.
+#define MULTIBOOT_CMDLINE_LEN 256
+
+// Information passed in ebx by a Multiboot loader. Only the fields up to the
+// memory map are declared.
+typedef struct {
+    uint32_t flags;
+
+    // KiB of memory below 1 MiB, and above 1 MiB up to the first hole.
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+
+    // Address and total size in bytes of the memory map.
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+} __attribute__((packed)) multiboot_info_t;
+
+// An entry of the memory map. size is the size of the rest of the entry, which
+// may be larger than the fields declared here.
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+/*
+Record what the loader passed to the kernel. The command line and memory map
+are copied, since the memory they're in isn't reserved. This must be called at
+the start of main(), before anything is allocated.
+
+@param magic: The value of eax on entry to the kernel.
+@param info: The value of ebx on entry to the kernel.
+*/
+void multiboot_init(uint32_t magic, const multiboot_info_t *info);
+
+/*
+Check whether the kernel was booted by a Multiboot loader, rather than by our
+own bootloader. Either may pass a memory map.
+*/
+bool multiboot_booted();
+
+/*
+Get the kernel command line. This is empty if the loader didn't pass one.
+Loaders usually start it with the path of the kernel image.
+*/
+const char *multiboot_get_cmdline();
+
+/*
+Get the value of an option on the command line. Options are separated by
+spaces, and are either "name=value" or just "name". Return the value, which
+is terminated by a space or the end of the command line, or "" if the option
+has no value. Return NULL if the option isn't on the command line.
+
+@param name: Name of the option.
+*/
+const char *multiboot_get_option(const char *name);
+
+/*
+Get the memory map passed by the loader. Return the number of entries, which is
+0 if there is no memory map.
+
+@param entries: Receives a pointer to the entries.
+*/
+uint32_t multiboot_get_mmap(const multiboot_mmap_entry_t **entries);
+
+#endif // _DREWOS_MULTIBOOT_H_
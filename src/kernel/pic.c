@@ -1,11 +1,16 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "pic.h"
+#include "apic.h"
 #include "low_level.h"
 
 // PIC1 = PIC_MASTER
 // PIC2 = PIC_SLAVE
 
+// Once pic_switch_to_apic() has succeeded, the functions below operate on the
+// local APIC and I/O APIC instead of the 8259s.
+
 #define PIC_MASTER_COMMAND 0x0020
 #define PIC_MASTER_DATA 0x0021
 #define PIC_SLAVE_COMMAND 0x00a0
@@ -59,6 +64,11 @@ static uint8_t _offset1;
 Send an end-of-interrupt command to the PIC.
 */
 void pic_send_eoi(uint8_t irq) {
+    if (apic_enabled()) {
+        apic_send_eoi();
+        return;
+    }
+
     if (irq >= 8) {
         write_byte(PIC_SLAVE_COMMAND, PIC_EOI);
     }
@@ -133,13 +143,42 @@ void pic_disable() {
 }
 
 uint8_t pic_get_vector(uint8_t irq) {
+    if (apic_enabled()) {
+        return APIC_IRQ_BASE + irq;
+    }
     if (irq < 8) {
         return _offset0 + irq;
     }
     return _offset1 + (irq - 8);
 }
 
+/*
+Get the IRQ which is mapped to the specified vector, or -1 if the vector is not
+mapped to either PIC.
+*/
+int16_t pic_get_irq(uint8_t vector) {
+    if (apic_enabled()) {
+        if (vector >= APIC_IRQ_BASE && vector < APIC_IRQ_BASE + APIC_MAX_IRQS) {
+            return vector - APIC_IRQ_BASE;
+        }
+        return -1;
+    }
+
+    if (vector >= _offset0 && vector < _offset0 + 8) {
+        return vector - _offset0;
+    }
+    if (vector >= _offset1 && vector < _offset1 + 8) {
+        return vector - _offset1 + 8;
+    }
+    return -1;
+}
+
 void irq_set_mask(uint8_t irq_line) {
+    if (apic_enabled()) {
+        ioapic_set_mask(irq_line, true);
+        return;
+    }
+
     uint16_t port;
 
     if (irq_line < 8) {
@@ -154,6 +193,11 @@ void irq_set_mask(uint8_t irq_line) {
 }
 
 void irq_clear_mask(uint8_t irq_line) {
+    if (apic_enabled()) {
+        ioapic_set_mask(irq_line, false);
+        return;
+    }
+
     uint16_t port;
 
     if (irq_line < 8) {
@@ -185,3 +229,54 @@ uint16_t pic_get_irr() {
 uint16_t pic_get_isr() {
     return pic_get_irq_reg(PIC_READ_ISR);
 }
+
+/*
+Check whether an interrupt on the specified IRQ is spurious. A PIC raises IRQ 7
+(or 15, for the slave) if the interrupt which it was signalling goes away
+before the CPU acknowledges it. Such interrupts are not in service, and must
+not be acknowledged with an EOI.
+*/
+bool pic_is_spurious(uint8_t irq) {
+    // The local APIC raises its own vector for spurious interrupts.
+    if (apic_enabled() || (irq != 7 && irq != 15)) {
+        return false;
+    }
+    if (pic_get_isr() & (1 << irq)) {
+        return false;
+    }
+
+    // The master PIC doesn't know that the slave's interrupt was spurious, so
+    // it still expects an EOI for the cascade IRQ.
+    if (irq == 15) {
+        write_byte(PIC_MASTER_COMMAND, PIC_EOI);
+    }
+    return true;
+}
+
+/*
+Deliver interrupts through the local APIC and I/O APIC instead of the 8259
+PICs, if the system has them. The 8259s are masked off, and every IRQ which was
+unmasked in the 8259s is unmasked in the I/O APIC, so handlers which have
+already been installed keep working. Return false if there is no APIC, in which
+case the 8259s are left alone.
+*/
+bool pic_switch_to_apic() {
+    uint32_t flags = irq_save();
+
+    uint16_t mask = (read_byte(PIC_SLAVE_DATA) << 8) | read_byte(PIC_MASTER_DATA);
+    if (!apic_init()) {
+        irq_restore(flags);
+        return false;
+    }
+    pic_disable();
+
+    // IRQ 2 is the cascade from the slave 8259, and is meaningless here.
+    for (uint8_t irq = 0; irq < 16; irq++) {
+        if (irq != 2 && !(mask & (1 << irq))) {
+            ioapic_set_mask(irq, false);
+        }
+    }
+
+    irq_restore(flags);
+    return true;
+}
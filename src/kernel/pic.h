@@ -2,15 +2,19 @@
 #define _DREWOS_PIC_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 void pic_send_eoi(uint8_t irq);
 void pic_remap(int offset1, int offset2);
 uint8_t pic_get_vector(uint8_t irq);
+int16_t pic_get_irq(uint8_t vector);
 void pic_init();
 void pic_disable();
 void irq_set_mask(uint8_t irq_line);
 void irq_clear_mask(uint8_t irq_line);
 uint16_t pic_get_irr();
 uint16_t pic_get_isr();
+bool pic_is_spurious(uint8_t irq);
+bool pic_switch_to_apic();
 
 #endif // _DREWOS_PIC_H_
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ring.h"
+
+// Only the producer writes head, and only the consumer writes tail. Each side
+// publishes its index with a release store once it's done with the slot, and
+// reads the other side's index with an acquire load, so a byte is never read
+// before it's written, or overwritten before it's read.
+
+void byte_ring_init(byte_ring_t *ring, uint8_t *buf, uint32_t size) {
+    byte_ring_init_stamped(ring, buf, 0, size);
+}
+
+void byte_ring_init_stamped(byte_ring_t *ring, uint8_t *buf, uint64_t *stamps, uint32_t size) {
+    ring->buf = buf;
+    ring->stamps = stamps;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+}
+
+bool byte_ring_put_stamped(byte_ring_t *ring, uint8_t byte, uint64_t stamp) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->size) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint32_t i = head & (ring->size - 1);
+    ring->buf[i] = byte;
+    if (ring->stamps) {
+        ring->stamps[i] = stamp;
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool byte_ring_put(byte_ring_t *ring, uint8_t byte) {
+    return byte_ring_put_stamped(ring, byte, 0);
+}
+
+bool byte_ring_get_stamped(byte_ring_t *ring, uint8_t *byte, uint64_t *stamp) {
+    uint32_t tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    uint32_t i = tail & (ring->size - 1);
+    *byte = ring->buf[i];
+    *stamp = ring->stamps ? ring->stamps[i] : 0;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool byte_ring_get(byte_ring_t *ring, uint8_t *byte) {
+    uint64_t stamp;
+    return byte_ring_get_stamped(ring, byte, &stamp);
+}
+
+bool byte_ring_empty(const byte_ring_t *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+uint32_t byte_ring_get_dropped(const byte_ring_t *ring) {
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,103 @@
+#ifndef _DREWOS_RING_H_
+#define _DREWOS_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A queue of bytes with a single producer and a single consumer, which need no
+// lock between them. It's meant for passing bytes from an interrupt handler to
+// code outside interrupt context: the producer never blocks or waits for the
+// consumer, and drops bytes if the ring is full.
+typedef struct {
+    uint8_t *buf;
+
+    // Optional timestamp of each byte, in a parallel array of the same size,
+    // or 0.
+    uint64_t *stamps;
+
+    // Size of buf. Must be a power of 2.
+    uint32_t size;
+
+    // Number of bytes ever written by the producer, and read by the consumer.
+    // These are only ever incremented, and wrap around.
+    uint32_t head;
+    uint32_t tail;
+
+    // Number of bytes dropped because the ring was full.
+    uint32_t dropped;
+} byte_ring_t;
+
+/*
+Initialise an empty ring.
+
+@param ring: The ring.
+@param buf: Storage for the bytes in the ring.
+@param size: Size of buf. Must be a power of 2.
+*/
+void byte_ring_init(byte_ring_t *ring, uint8_t *buf, uint32_t size);
+
+/*
+Initialise an empty ring which also records a timestamp with each byte, eg the
+value of the TSC when the byte arrived.
+
+@param ring: The ring.
+@param buf: Storage for the bytes in the ring.
+@param stamps: Storage for the timestamps, with the same number of entries as
+buf.
+@param size: Size of buf. Must be a power of 2.
+*/
+void byte_ring_init_stamped(byte_ring_t *ring, uint8_t *buf, uint64_t *stamps, uint32_t size);
+
+/*
+Append a byte to the ring. Return false, and count the byte as dropped, if the
+ring is full. This must only be called by the producer.
+
+@param ring: The ring.
+@param byte: The byte.
+*/
+bool byte_ring_put(byte_ring_t *ring, uint8_t byte);
+
+/*
+Append a byte and its timestamp to a ring initialised with
+byte_ring_init_stamped(). This must only be called by the producer.
+
+@param ring: The ring.
+@param byte: The byte.
+@param stamp: The timestamp.
+*/
+bool byte_ring_put_stamped(byte_ring_t *ring, uint8_t byte, uint64_t stamp);
+
+/*
+Remove the oldest byte from the ring. Return false if the ring is empty. This
+must only be called by the consumer.
+
+@param ring: The ring.
+@param byte: Receives the byte.
+*/
+bool byte_ring_get(byte_ring_t *ring, uint8_t *byte);
+
+/*
+Remove the oldest byte and its timestamp from a ring initialised with
+byte_ring_init_stamped(). This must only be called by the consumer.
+
+@param ring: The ring.
+@param byte: Receives the byte.
+@param stamp: Receives the timestamp.
+*/
+bool byte_ring_get_stamped(byte_ring_t *ring, uint8_t *byte, uint64_t *stamp);
+
+/*
+Check whether the ring is empty.
+
+@param ring: The ring.
+*/
+bool byte_ring_empty(const byte_ring_t *ring);
+
+/*
+Get the number of bytes dropped because the ring was full.
+
+@param ring: The ring.
+*/
+uint32_t byte_ring_get_dropped(const byte_ring_t *ring);
+
+#endif // _DREWOS_RING_H_
@@ -0,0 +1,22 @@
+#ifndef _DREWOS_SECTIONS_H_
+#define _DREWOS_SECTIONS_H_
+
+// Bounds of the kernel image and its sections, defined by linker.ld. Only the
+// addresses of these are meaningful. Each section starts on a page boundary.
+extern char __kernel_start[];
+extern char __kernel_end[];
+
+extern char __text_start[];
+extern char __text_end[];
+
+extern char __rodata_start[];
+extern char __rodata_end[];
+
+extern char __data_start[];
+extern char __data_end[];
+
+// .bss is zeroed by kernel_entry before main() is called.
+extern char __bss_start[];
+extern char __bss_end[];
+
+#endif // _DREWOS_SECTIONS_H_
@@ -0,0 +1,317 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "clock.h"
+#include "dmath.h"
+#include "low_level.h"
+#include "memory.h"
+
+// The timer wheel is a hierarchy of arrays of lists, indexed by expiry tick.
+//
+// The root level has a slot for each of the next ROOT_SIZE ticks. Each outer
+// level has LEVEL_SIZE slots, each of which covers as many ticks as the whole
+// of the level below it. Adding or removing a timer only touches one list, so
+// it takes constant time however many timers are pending.
+//
+// When the root level wraps around, the next slot of the level above is
+// emptied, and its timers are redistributed into the levels below
+// ("cascading"). Each timer is cascaded at most once per level.
+//
+// Each level also has a bitmap of which of its slots are occupied, so that the
+// next expiry can be found without walking the lists.
+
+#define ROOT_BITS 8
+#define ROOT_SIZE (1 << ROOT_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+
+#define LEVEL_BITS 6
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+
+// Number of levels above the root. Together, the levels span 2^32 ticks.
+#define NLEVELS 4
+
+// Timers further in the future than this are placed in the outermost level,
+// and moved inwards when they reach the root level.
+#define MAX_DELTA 0xffffffffull
+
+static ktimer_t *root[ROOT_SIZE];
+static ktimer_t *levels[NLEVELS][LEVEL_SIZE];
+
+// Bit i of a level's bitmap is set iff slot i of the level is non-empty.
+static uint32_t root_map[ROOT_SIZE / 32];
+static uint32_t level_maps[NLEVELS][LEVEL_SIZE / 32];
+
+// The next tick to be processed by timer_run().
+static uint64_t wheel_ticks = 0;
+
+// Set while timer_run() is running, so that it's never reentered.
+static bool running = false;
+
+static inline uint32_t bsf(uint32_t x) {
+    uint32_t index;
+    __asm__("bsfl %1, %0" : "=r" (index) : "rm" (x));
+    return index;
+}
+
+static inline void set_bit(uint32_t *map, uint32_t bit) {
+    map[bit / 32] |= 1u << (bit % 32);
+}
+
+static inline void clear_bit(uint32_t *map, uint32_t bit) {
+    map[bit / 32] &= ~(1u << (bit % 32));
+}
+
+/*
+Find the first set bit in a bitmap of n bits, searching upwards from bit start
+and wrapping around. Return its distance from start, or n if no bits are set.
+
+@param map: The bitmap.
+@param n: Number of bits in the bitmap, which is a multiple of 32.
+@param start: The bit to start at.
+*/
+static uint32_t find_next_bit(const uint32_t *map, uint32_t n, uint32_t start) {
+    for (uint32_t offset = 0; offset < n;) {
+        uint32_t bit = (start + offset) & (n - 1);
+        uint32_t word = map[bit / 32] >> (bit % 32);
+        if (word) {
+            return offset + bsf(word);
+        }
+        offset += 32 - bit % 32;
+    }
+    return n;
+}
+
+/*
+Clear the occupancy bit of a wheel slot, if head is the head of a slot's list.
+*/
+static void clear_slot(ktimer_t **head) {
+    uintptr_t addr = (uintptr_t)head;
+    if (addr >= (uintptr_t)root && addr < (uintptr_t)(root + ROOT_SIZE)) {
+        clear_bit(root_map, head - root);
+        return;
+    }
+    for (uint8_t level = 0; level < NLEVELS; level++) {
+        if (addr >= (uintptr_t)levels[level] && addr < (uintptr_t)(levels[level] + LEVEL_SIZE)) {
+            clear_bit(level_maps[level], head - levels[level]);
+            return;
+        }
+    }
+}
+
+static void list_add(ktimer_t **head, ktimer_t *timer) {
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void list_del(ktimer_t *timer) {
+    // If the timer was the only one in a wheel slot, the slot is now empty.
+    if (!timer->next) {
+        clear_slot(timer->pprev);
+    }
+
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+/*
+Add a timer to the wheel slot for its expiry time. Interrupts must be disabled.
+*/
+static void enqueue(ktimer_t *timer) {
+    uint64_t expires = timer->expires;
+
+    // Overdue timers expire on the next tick to be processed.
+    if (expires < wheel_ticks) {
+        expires = wheel_ticks;
+    }
+
+    uint64_t delta = expires - wheel_ticks;
+    if (delta < ROOT_SIZE) {
+        list_add(&root[expires & ROOT_MASK], timer);
+        set_bit(root_map, expires & ROOT_MASK);
+        return;
+    }
+
+    if (delta > MAX_DELTA) {
+        expires = wheel_ticks + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    uint8_t level = 0;
+    uint32_t shift = ROOT_BITS;
+    while (level < NLEVELS - 1 && delta >> (shift + LEVEL_BITS)) {
+        level++;
+        shift += LEVEL_BITS;
+    }
+    uint32_t index = (expires >> shift) & LEVEL_MASK;
+    list_add(&levels[level][index], timer);
+    set_bit(level_maps[level], index);
+}
+
+/*
+Move every timer in the current slot of a level into the levels below it.
+Return the index of that slot. Interrupts must be disabled.
+*/
+static uint32_t cascade(uint8_t level) {
+    uint32_t index = (wheel_ticks >> (ROOT_BITS + level * LEVEL_BITS)) & LEVEL_MASK;
+
+    ktimer_t *timer = levels[level][index];
+    levels[level][index] = 0;
+    clear_bit(level_maps[level], index);
+    while (timer) {
+        ktimer_t *next = timer->next;
+        enqueue(timer);
+        timer = next;
+    }
+    return index;
+}
+
+void timers_init() {
+    memset(root, 0, sizeof(root));
+    memset(levels, 0, sizeof(levels));
+    memset(root_map, 0, sizeof(root_map));
+    memset(level_maps, 0, sizeof(level_maps));
+    wheel_ticks = clock_get_ticks();
+    running = false;
+}
+
+void timer_init(ktimer_t *timer, timer_fn_t fn, void *data) {
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+    timer->pending = false;
+}
+
+void timer_add(ktimer_t *timer, uint64_t expires) {
+    uint32_t flags = irq_save();
+    if (timer->pending) {
+        list_del(timer);
+    }
+    timer->expires = expires;
+    timer->pending = true;
+    enqueue(timer);
+    irq_restore(flags);
+}
+
+void timer_mod(ktimer_t *timer, uint64_t expires) {
+    timer_add(timer, expires);
+}
+
+bool timer_del(ktimer_t *timer) {
+    uint32_t flags = irq_save();
+    bool pending = timer->pending;
+    if (pending) {
+        list_del(timer);
+        timer->pending = false;
+    }
+    irq_restore(flags);
+    return pending;
+}
+
+bool timer_pending(const ktimer_t *timer) {
+    return timer->pending;
+}
+
+uint64_t timer_deadline_ms(uint32_t ms) {
+    uint64_t ticks = (uint64_t)ms * CLOCK_HZ + 999;
+    div64_32(&ticks, 1000);
+    return clock_get_ticks() + ticks;
+}
+
+uint64_t timer_next_expiry() {
+    uint32_t flags = irq_save();
+
+    // Timers in the root level expire on the tick of their slot, and timers
+    // which were overdue when they were added are in the slot for
+    // wheel_ticks.
+    uint64_t min = ~0ull;
+    uint32_t offset = find_next_bit(root_map, ROOT_SIZE, wheel_ticks & ROOT_MASK);
+    if (offset < ROOT_SIZE) {
+        min = wheel_ticks + offset;
+    }
+
+    // A slot of an outer level can't expire before the first tick it covers,
+    // which is when timer_run() cascades it, so that tick is used as the
+    // bound. The current slot of a level has already been cascaded, and only
+    // holds timers a whole level away, unless wheel_ticks is its first tick,
+    // in which case timer_run() cascades it on that tick.
+    uint32_t shift = ROOT_BITS;
+    for (uint8_t level = 0; level < NLEVELS; level++, shift += LEVEL_BITS) {
+        uint64_t slot = wheel_ticks >> shift;
+        if (wheel_ticks & ((1ull << shift) - 1)) {
+            slot++;
+        }
+        offset = find_next_bit(level_maps[level], LEVEL_SIZE, slot & LEVEL_MASK);
+        if (offset < LEVEL_SIZE) {
+            uint64_t start = (slot + offset) << shift;
+            if (start < min) {
+                min = start;
+            }
+        }
+    }
+    irq_restore(flags);
+
+    return min;
+}
+
+void timer_run() {
+    if (__atomic_exchange_n(&running, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    uint64_t now = clock_get_ticks();
+
+    while (wheel_ticks <= now) {
+        uint32_t index = wheel_ticks & ROOT_MASK;
+
+        // When the root level wraps around, refill it from the level above,
+        // and so on outwards.
+        if (index == 0) {
+            for (uint8_t level = 0; level < NLEVELS && cascade(level) == 0; level++);
+        }
+
+        // Detach the whole slot, so that timers which are re-added by their
+        // functions don't run again in this pass.
+        ktimer_t *expired = root[index];
+        root[index] = 0;
+        clear_bit(root_map, index);
+        if (expired) {
+            expired->pprev = &expired;
+        }
+        wheel_ticks++;
+
+        while (expired) {
+            ktimer_t *timer = expired;
+            list_del(timer);
+
+            // Timers which were too far in the future to place exactly are
+            // put back in the wheel.
+            if (timer->expires >= wheel_ticks) {
+                enqueue(timer);
+                continue;
+            }
+
+            // Run the function with interrupts enabled. The timer may be
+            // re-added or deleted from here on, including by its own function.
+            timer->pending = false;
+            irq_restore(flags);
+            timer->fn(timer->data);
+            flags = irq_save();
+        }
+    }
+
+    irq_restore(flags);
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,103 @@
+#ifndef _DREWOS_TIMER_H_
+#define _DREWOS_TIMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Function called when a timer expires.
+typedef void (*timer_fn_t)(void *data);
+
+// A one-shot kernel timer. Timers are measured in PIT ticks (see
+// clock_get_ticks()). The fields are private to timer.c.
+typedef struct ktimer {
+    // Links in the list of timers in the same wheel slot. pprev points at the
+    // pointer which points at this timer, so that a timer can be removed
+    // without knowing which slot it's in.
+    struct ktimer *next;
+    struct ktimer **pprev;
+
+    // Tick at which the timer expires.
+    uint64_t expires;
+
+    timer_fn_t fn;
+    void *data;
+    bool pending;
+} ktimer_t;
+
+/*
+Initialise the timer wheel. This must be called after clock_init().
+*/
+void timers_init();
+
+/*
+Initialise a timer. This must be called before the timer is first added.
+
+@param timer: The timer.
+@param fn: Function to call when the timer expires.
+@param data: Argument passed to fn.
+*/
+void timer_init(ktimer_t *timer, timer_fn_t fn, void *data);
+
+/*
+Start a timer. If the timer is already pending, it's moved to the new expiry
+time. This takes constant time, regardless of how many timers are pending, and
+may be called from any context.
+
+@param timer: The timer.
+@param expires: Tick at which the timer should expire. If this is in the past,
+the timer expires on the next call to timer_run().
+*/
+void timer_add(ktimer_t *timer, uint64_t expires);
+
+/*
+Change the expiry time of a timer, starting it if it's not pending. This is
+equivalent to timer_add().
+
+@param timer: The timer.
+@param expires: Tick at which the timer should expire.
+*/
+void timer_mod(ktimer_t *timer, uint64_t expires);
+
+/*
+Stop a timer. Return true if the timer was pending. This takes constant time,
+and may be called from any context.
+
+@param timer: The timer.
+*/
+bool timer_del(ktimer_t *timer);
+
+/*
+Check whether a timer is waiting to expire.
+
+@param timer: The timer.
+*/
+bool timer_pending(const ktimer_t *timer);
+
+/*
+Get the tick which is the specified number of milliseconds from now, rounded
+up, for use as a timer's expiry time.
+
+@param ms: Number of milliseconds.
+*/
+uint64_t timer_deadline_ms(uint32_t ms);
+
+/*
+Get the tick at which timer_run() next has work to do, or ~0 if no timers are
+pending. This takes constant time, however many timers are pending.
+
+For timers due within the next 256 ticks, this is when the earliest of them
+expires, or the next tick to be processed if it's overdue. Timers further away
+are only tracked by their slot in an outer level of the wheel, so for those
+this is the tick at which the slot is cascaded, which may be earlier than the
+expiry time.
+*/
+uint64_t timer_next_expiry();
+
+/*
+Call the functions of every timer which has expired. Timers expire on the PIT
+tick, but their functions are only called from here, outside interrupt
+context. This must not be called from interrupt context.
+*/
+void timer_run();
+
+#endif // _DREWOS_TIMER_H_